@@ -4,9 +4,18 @@
 #include <iostream>
 #include <chrono>
 #include <unordered_map>
+#include <unordered_set>
 #include <filesystem>
 #include <fstream>
+#include <thread>
+#include <shared_mutex>
+#include <bit>
 #include "../Tree-sitter-jai-lib/TreeSitterJai.h"
+#include "../Tree-sitter-jai-lib/FileScope.h"
+#include "../Tree-sitter-jai-lib/Newlines.h"
+#include "../Tree-sitter-jai-lib/Timer.h"
+#include "../Tree-sitter-jai-lib/ParserPool.h"
+#include "../Tree-sitter-jai-lib/stb_ds.h"
 
 
 extern "C"
@@ -184,10 +193,757 @@ void ParseModules(int tries)
 		std::cout << time << ",";
 	}
 
+	uint64_t hits, misses;
+	GetParserPoolStats(&hits, &misses);
+	std::cout << "\nparser pool: " << hits << " hits, " << misses << " misses\n";
 }
 
 
 
+static std::string MakeSyntheticFile(int lines)
+{
+	std::string code;
+	char line[128];
+	for (int i = 0; i < lines; i++)
+	{
+		snprintf(line, sizeof(line), "proc_%d :: (a: int, b: float) -> int { return a + %d; }\n", i, i);
+		code.append(line);
+	}
+
+	return code;
+}
+
+static long long ReplayTopBottomEdits(GapBuffer& store, int lines, int edits)
+{
+	const char* insertion = "x := 1; ";
+	auto insertionLength = (int)strlen(insertion);
+	auto timer = Timer("");
+
+	for (int i = 0; i < edits; i++)
+	{
+		// alternate between the first and the last line, which is the worst case for the gap buffer.
+		auto line = (i % 2 == 0) ? 0 : lines - 1;
+		store.Edit(line, 0, line, 0, insertion, insertionLength, 0);
+	}
+
+	return timer.GetMicroseconds();
+}
+
+static void TextStoreBenchmark(int lines, int edits)
+{
+	auto code = MakeSyntheticFile(lines);
+
+	auto gapBuffer = GapBuffer(code.c_str(), (int)code.length());
+	auto gapTime = ReplayTopBottomEdits(gapBuffer, lines, edits);
+
+	std::cout << "text store: " << lines << " lines, " << edits << " alternating top/bottom edits\n";
+	std::cout << "gap buffer: " << gapTime << " us\n";
+}
+
+static const char* ReadGapBuffer(void* payload, uint32_t byteOffset, TSPoint position, uint32_t* bytesRead)
+{
+	GapBuffer* gapBuffer = (GapBuffer*)payload;
+	return gapBuffer->Read(byteOffset, bytesRead);
+}
+
+static const char* ReadGapBufferByteAtATime(void* payload, uint32_t byteOffset, TSPoint position, uint32_t* bytesRead)
+{
+	// what tree-sitter used to get for text after the gap, to compare the chunked reader against.
+	GapBuffer* gapBuffer = (GapBuffer*)payload;
+	auto chunk = gapBuffer->Read(byteOffset, bytesRead);
+	if (*bytesRead > 1)
+		*bytesRead = 1;
+
+	return chunk;
+}
+
+// reparses the whole document from scratch through the TSInput reader, for benchmarking the read callback.
+static long long MeasureReparse(Hash documentHash, bool byteAtATime)
+{
+	auto buffer = GetDocument(documentHash)->buffer;
+
+	auto parser = PooledParser();
+
+	TSInput input;
+	input.encoding = TSInputEncodingUTF8;
+	input.read = byteAtATime ? ReadGapBufferByteAtATime : ReadGapBuffer;
+	input.payload = buffer;
+
+	auto timer = Timer("");
+	auto tree = ts_parser_parse(parser, nullptr, input);
+	auto time = timer.GetMicroseconds();
+
+	ts_tree_delete(tree);
+
+	return time;
+}
+
+static void ReparseBenchmark(int lines, int tries)
+{
+	auto code = MakeSyntheticFile(lines);
+	auto documentPath = "reparse_benchmark.jai";
+	CreateTree(documentPath, code.c_str(), (int)code.length());
+	auto hash = StringHash(documentPath);
+
+	// put the gap at the top of the file, so nearly all of the text is after it.
+	const char* insertion = "x := 1;\n";
+	EditTree(hash, insertion, 0, 0, 0, 0, (int)strlen(insertion), 0);
+
+	long long chunkedTime = 0;
+	long long byteTime = 0;
+	for (int i = 0; i < tries; i++)
+	{
+		chunkedTime += MeasureReparse(hash, false);
+		byteTime += MeasureReparse(hash, true);
+	}
+
+	// bytes per microsecond is MB/s
+	auto megabytes = [&](long long time) { return (double)code.length() * tries / (double)time; };
+
+	std::cout << "reparse: " << lines << " lines, " << code.length() << " bytes, " << tries << " tries\n";
+	std::cout << "byte at a time reader: " << megabytes(byteTime) << " MB/s\n";
+	std::cout << "chunked reader: " << megabytes(chunkedTime) << " MB/s\n";
+}
+
+static void NewlineScanBenchmark(int files, int lines)
+{
+	// a corpus about the size of a modules folder, every file goes through the newline scan on load.
+	std::vector<std::string> corpus;
+	size_t totalBytes = 0;
+	for (int i = 0; i < files; i++)
+	{
+		corpus.push_back(MakeSyntheticFile(lines + i % 100));
+		totalBytes += corpus.back().length();
+	}
+
+	auto megabytes = [&](long long time) { return (double)totalBytes / (double)time; };
+
+	uint32_t scalarCount = 0;
+	auto timer = Timer("");
+	for (auto& file : corpus)
+		scalarCount += CountNewlinesScalar(file.c_str(), (uint32_t)file.length());
+	auto scalarCountTime = timer.GetMicroseconds();
+
+	uint32_t simdCount = 0;
+	timer = Timer("");
+	for (auto& file : corpus)
+		simdCount += CountNewlines(file.c_str(), (uint32_t)file.length());
+	auto simdCountTime = timer.GetMicroseconds();
+
+	std::vector<uint32_t> scalarOffsets;
+	timer = Timer("");
+	for (auto& file : corpus)
+	{
+		scalarOffsets.clear();
+		FindNewlinesScalar(file.c_str(), (uint32_t)file.length(), scalarOffsets);
+	}
+	auto scalarFindTime = timer.GetMicroseconds();
+
+	std::vector<uint32_t> simdOffsets;
+	timer = Timer("");
+	for (auto& file : corpus)
+	{
+		simdOffsets.clear();
+		FindNewlines(file.c_str(), (uint32_t)file.length(), simdOffsets);
+	}
+	auto simdFindTime = timer.GetMicroseconds();
+
+	uint32_t bufferLines = 0;
+	timer = Timer("");
+	for (auto& file : corpus)
+	{
+		auto gapBuffer = GapBuffer(file.c_str(), (int)file.length());
+		bufferLines += gapBuffer.LineCount() - 1;
+	}
+	auto bufferTime = timer.GetMicroseconds();
+
+	auto same = scalarCount == simdCount && scalarCount == bufferLines && scalarOffsets == simdOffsets;
+
+	std::cout << "newline scan: " << files << " files, " << totalBytes << " bytes, kernel " << NewlineKernelName() << "\n";
+	std::cout << "count scalar: " << megabytes(scalarCountTime) << " MB/s\n";
+	std::cout << "count simd: " << megabytes(simdCountTime) << " MB/s\n";
+	std::cout << "find scalar: " << megabytes(scalarFindTime) << " MB/s\n";
+	std::cout << "find simd: " << megabytes(simdFindTime) << " MB/s\n";
+	std::cout << "gap buffer construction: " << megabytes(bufferTime) << " MB/s\n";
+	std::cout << "results match: " << (same ? "yes" : "NO") << "\n";
+}
+
+
+static void IncrementalAnalysisCheck(int lines, int edits)
+{
+	// types into function bodies all over the file, and after every reparse compares the scopes against a full build.
+	auto code = MakeSyntheticFile(lines);
+	auto documentPath = "incremental_check.jai";
+	CreateTree(documentPath, code.c_str(), (int)code.length());
+	auto hash = StringHash(documentPath);
+
+	const char* insertion = "x := a; ";
+	char prefix[128];
+	int mismatches = 0;
+	long long updateTime = 0;
+
+	for (int i = 0; i < edits; i++)
+	{
+		// right after the opening brace of the procedure on that line.
+		auto line = (i * 7919) % lines;
+		auto column = snprintf(prefix, sizeof(prefix), "proc_%d :: (a: int, b: float) -> int { ", line);
+
+		EditTree(hash, insertion, line, column, line, column, (int)strlen(insertion), 0);
+		updateTime += UpdateTree(hash);
+		const char* report;
+		auto differences = VerifyIncrementalAnalysis(hash.value, &report);
+		if (differences > 0)
+			std::cout << report;
+		mismatches += differences;
+	}
+
+	std::cout << "incremental analysis: " << lines << " lines, " << edits << " edits\n";
+	std::cout << "average update: " << updateTime / edits << "us\n";
+	std::cout << "differences from a full build: " << mismatches << "\n";
+}
+
+
+static void ArenaBenchmark(int lines, int rebuilds)
+{
+	// full rebuilds of one file, the scope tables come out of the file's arenas.
+	auto code = MakeSyntheticFile(lines);
+	auto documentPath = "arena_benchmark.jai";
+	CreateTree(documentPath, code.c_str(), (int)code.length());
+	auto fileScope = GetDocument(StringHash(documentPath))->fileScope;
+
+	std::cout << "scope allocations: " << lines << " lines, " << rebuilds << " full rebuilds\n";
+	std::cout << "\theap\tarena\tchunks\tus per rebuild\n";
+
+	// one to fill both arenas, it isn't counted.
+	fileScope->status = FileScope::Status::dirty;
+	fileScope->Build();
+
+	uint64_t heapBefore, arenaBefore, chunksBefore;
+	GetAllocationStats(&heapBefore, &arenaBefore, &chunksBefore);
+
+	auto timer = Timer("");
+	for (int i = 0; i < rebuilds; i++)
+	{
+		fileScope->status = FileScope::Status::dirty;
+		fileScope->Build();
+	}
+	auto time = timer.GetMicroseconds();
+
+	uint64_t heap, arena, chunks;
+	GetAllocationStats(&heap, &arena, &chunks);
+	std::cout << "arenas\t" << (heap - heapBefore) / rebuilds << "\t" << (arena - arenaBefore) / rebuilds
+		<< "\t" << chunks - chunksBefore << "\t" << time / rebuilds << "\n";
+
+	std::cout << "arena capacity: " << (fileScope->arenas[0]->Capacity() + fileScope->arenas[1]->Capacity()) / 1024 << " KB\n";
+}
+
+
+static void HandleLimitsCheck()
+{
+	// files past what 16 bit handles and 24 bit offsets could hold.
+	int failures = 0;
+	auto check = [&](bool ok, const char* what)
+	{
+		std::cout << (ok ? "ok\t" : "FAILED\t") << what << "\n";
+		failures += !ok;
+	};
+
+	check(sizeof(ScopeDeclaration) == 24, "a declaration is 24 bytes");
+
+	ScopeDeclaration decl = {};
+	decl.startByte = ScopeDeclaration::maxStartByte;
+	decl.SetLength(ScopeDeclaration::maxLength);
+	decl.SetRHSOffset(ScopeDeclaration::maxLength);
+	decl.flags = (DeclarationFlags)(DeclarationFlags::Evaluated | DeclarationFlags::Exported);
+	check(decl.startByte == ScopeDeclaration::maxStartByte && decl.GetLength() == ScopeDeclaration::maxLength
+		&& decl.GetRHSOffset() == ScopeDeclaration::maxLength && decl.HasFlags(DeclarationFlags::Exported),
+		"the fields round trip at their limits, without spilling into each other");
+
+	decl.SetLength(ScopeDeclaration::maxLength + 5000);
+	decl.SetRHSOffset(ScopeDeclaration::maxLength + 1);
+	check(decl.GetLength() == ScopeDeclaration::maxLength && decl.GetRHSOffset() == ScopeDeclaration::maxLength
+		&& decl.HasFlags(DeclarationFlags::Exported),
+		"a length past the limit sticks at the limit");
+
+	// every procedure has a scope for its parameters and one for its body.
+	{
+		auto code = MakeSyntheticFile(70000);
+		auto documentPath = "handle_limits_scopes.jai";
+		CreateTree(documentPath, code.c_str(), (int)code.length());
+		auto fileScope = GetDocument(StringHash(documentPath))->fileScope;
+
+		check(fileScope->scopeKings.size() > UINT16_MAX, "more than 65535 scopes in a file");
+
+		int farScopesWithParameter = 0;
+		bool parentsInRange = true;
+		for (uint32_t i = UINT16_MAX + 1; i < fileScope->scopeKings.size(); i++)
+		{
+			auto scope = fileScope->GetScope({ i });
+			farScopesWithParameter += scope->TryGet(IdentifierHash("a")).has_value();
+			parentsInRange &= scope->parent.index < i;
+		}
+
+		check(farScopesWithParameter > 0, "parameters are found in scopes past index 65535");
+		check(parentsInRange, "scopes past index 65535 have their parents");
+		check(fileScope->GetScope(fileScope->file)->TryGet(IdentifierHash("proc_69999")).has_value(), "the last procedure is declared");
+	}
+
+	// offsets past 16 mb used to wrap around into the start of the file.
+	{
+		std::string code = "near :: 1;\n";
+		code.append(size_t(20) << 20, ' ');
+		auto farStart = (uint32_t)code.size();
+		code.append("far_away :: 1;\n");
+
+		auto documentPath = "handle_limits_offsets.jai";
+		CreateTree(documentPath, code.c_str(), (int)code.length());
+		auto fileScope = GetDocument(StringHash(documentPath))->fileScope;
+		auto found = fileScope->GetScope(fileScope->file)->TryGet(IdentifierHash("far_away"));
+
+		check(found && found->startByte == farStart, "a declaration past 16 mb keeps its start byte");
+	}
+
+	{
+		auto first = GetOrCreateFileScope(StringHash("handle_limits_file_0"), "");
+		FileScope* last = nullptr;
+		for (int i = 1; i <= 70000; i++)
+		{
+			auto name = "handle_limits_file_" + std::to_string(i);
+			last = GetOrCreateFileScope(StringHash(name), "");
+		}
+
+		check(last->fileIndex > UINT16_MAX && last->fileIndex - first->fileIndex == 70000, "file indices past 65535");
+		check(GetFileScope(last->fileIndex) == last, "a file past index 65535 is found from its index");
+	}
+
+	std::cout << "handle limits: " << failures << " failed\n";
+}
+
+
+// ConcurrentDictionary as it was before, a shared_mutex over an unordered_map. kept to compare against.
+template <typename T>
+struct LockedDictionary
+{
+	std::shared_mutex mutex;
+	std::unordered_map<Hash, T> dict;
+
+	std::optional<T> Read(Hash key)
+	{
+		std::shared_lock<std::shared_mutex> lock(mutex);
+		auto it = dict.find(key);
+		if (it == dict.end())
+			return std::nullopt;
+
+		return it->second;
+	}
+
+	void Write(Hash key, T value)
+	{
+		std::unique_lock<std::shared_mutex> lock(mutex);
+		dict[key] = value;
+	}
+};
+
+template <typename Dictionary>
+static double DictionaryLookupRate(int readers, int files, int milliseconds)
+{
+	// the files every request looks up, and a writer registering modules the whole time.
+	Dictionary dictionary;
+	auto key = [](uint64_t i) { return StringHash("file_" + std::to_string(i)); };
+	for (int i = 0; i < files; i++)
+		dictionary.Write(key(i), (uint64_t)i);
+
+	std::atomic<bool> stop = false;
+	std::atomic<uint64_t> lookups = 0;
+
+	std::thread writer([&]()
+	{
+		uint64_t module = 0;
+		while (!stop)
+		{
+			dictionary.Write(key(files + module % 4096), module);
+			module++;
+			std::this_thread::yield();
+		}
+	});
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < readers; t++)
+	{
+		threads.emplace_back([&, t]()
+		{
+			std::vector<Hash> keys;
+			for (int i = 0; i < files; i++)
+				keys.push_back(key((i * 7919 + t) % files));
+
+			uint64_t count = 0;
+			uint64_t found = 0;
+			while (!stop)
+			{
+				for (auto& k : keys)
+					found += dictionary.Read(k).has_value();
+
+				count += keys.size();
+			}
+
+			lookups += count;
+			assert(found == count);
+		});
+	}
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+	stop = true;
+
+	for (auto& thread : threads)
+		thread.join();
+	writer.join();
+
+	// lookups per microsecond is millions per second
+	return (double)lookups / (milliseconds * 1000.0);
+}
+
+static void HashBenchmark(int megabytesPerSize)
+{
+	// identifiers are mostly under 16 bytes, full paths are 40 to 200.
+	std::cout << "string hashing, " << megabytesPerSize << " MB per size, in MB/s, kernel " << (HASH_KERNEL == HASH_KERNEL_WYHASH ? "wyhash" : "fnv1a") << "\n";
+	std::cout << "bytes\tfnv1a\twyhash\tchecksum\n";
+
+	std::string text = MakeSyntheticFile(2000);
+	for (size_t size : { 4, 8, 12, 16, 24, 32, 48, 64, 96, 128, 256, 1024, 4096 })
+	{
+		auto count = (size_t)megabytesPerSize * 1024 * 1024 / size;
+		auto strings = text.length() - size;
+
+		uint64_t sink = 0;
+		auto timer = Timer("");
+		for (size_t i = 0; i < count; i++)
+			sink += Fnv1a(text.data() + (i * 31) % strings, size);
+		auto fnvTime = timer.GetMicroseconds();
+
+		timer = Timer("");
+		for (size_t i = 0; i < count; i++)
+			sink += WyHash(text.data() + (i * 31) % strings, size);
+		auto wyTime = timer.GetMicroseconds();
+
+		auto rate = [&](long long time) { return (double)(count * size) / (double)std::max(time, 1LL); };
+		std::cout << size << "\t" << rate(fnvTime) << "\t" << rate(wyTime) << "\t" << (sink & 0xffff) << "\n";
+	}
+
+	// every name a module would have, none of them may land on the same hash.
+	std::unordered_set<uint64_t> seen;
+	size_t collisions = 0;
+	for (int i = 0; i < 1000000; i++)
+	{
+		auto name = "C:/jai/modules/Module_" + std::to_string(i % 1000) + "/file_" + std::to_string(i) + ".jai";
+		collisions += !seen.insert(StringHash(name).value).second;
+	}
+
+	std::cout << "collisions in 1000000 paths: " << collisions << "\n";
+}
+
+
+static void DictionaryContentionBenchmark(int files, int milliseconds)
+{
+	std::cout << "dictionary lookups with one writer, " << files << " files, in millions per second\n";
+	std::cout << "readers\tshared_mutex\tlock free\n";
+
+	for (int readers = 1; readers <= (int)std::max(4u, std::thread::hardware_concurrency()); readers *= 2)
+	{
+		auto locked = DictionaryLookupRate<LockedDictionary<uint64_t>>(readers, files, milliseconds);
+		auto lockFree = DictionaryLookupRate<ConcurrentDictionary<uint64_t>>(readers, files, milliseconds);
+		std::cout << readers << "\t" << locked << "\t\t" << lockFree << "\n";
+	}
+}
+
+
+// the scope map as it was, on stb_ds.
+struct StbScopemap
+{
+	struct kvp
+	{
+		Hash key;
+		ScopeDeclaration value;
+	};
+
+	kvp* map = nullptr;
+
+	struct KeyView
+	{
+		kvp* map;
+		Hash operator[](size_t index) const { return map[index].key; }
+	};
+
+	void Add(Hash key, ScopeDeclaration value) { idput(map, key, value); }
+	int GetIndex(Hash key) { ptrdiff_t temp; return (int)idgeti_ts(map, key, temp); }
+	KeyView Keys() { return { map }; }
+	void Clear() { idfree(map); }
+};
+
+template <typename Map>
+static void BuildAndLookUp(const std::vector<std::vector<std::pair<Hash, ScopeDeclaration>>>& scopes, int rounds, long long* buildTime, long long* lookupTime, uint64_t* found)
+{
+	std::vector<Map> maps(scopes.size());
+	auto timer = Timer("");
+	for (size_t i = 0; i < scopes.size(); i++)
+	{
+		for (auto& [key, decl] : scopes[i])
+			maps[i].Add(key, decl);
+	}
+	*buildTime = timer.GetMicroseconds();
+
+	// a lookup walks out through the parents, so most scopes get asked for names they don't have.
+	// every scope is asked for its own names and the names of the scope before it.
+	// stb_ds finds a key of 0 in any map, and 0 is the first identifier interned, so a hit has to be the right key to count.
+	auto lookUp = [](Map& map, Hash key) { auto index = map.GetIndex(key); return index >= 0 && map.Keys()[index] == key; };
+
+	timer = Timer("");
+	for (int round = 0; round < rounds; round++)
+	{
+		for (size_t i = 0; i < scopes.size(); i++)
+		{
+			for (auto& [key, decl] : scopes[i])
+				*found += lookUp(maps[i], key);
+
+			if (i > 0)
+			{
+				for (auto& [key, decl] : scopes[i - 1])
+					*found += lookUp(maps[i], key);
+			}
+		}
+	}
+	*lookupTime = timer.GetMicroseconds();
+
+	for (auto& map : maps)
+		map.Clear();
+}
+
+// run it after something's been parsed, like ParseModules, so the scopes are real ones.
+static void ScopemapBenchmark(int rounds)
+{
+	std::vector<std::vector<std::pair<Hash, ScopeDeclaration>>> scopes;
+	size_t lookups = 0;
+	size_t histogram[6] = {};
+	for (size_t f = 0; f < g_fileScopeByIndex.size(); f++)
+	{
+		auto& scopeKings = g_fileScopeByIndex.Read(f)->scopeKings;
+		for (size_t s = 0; s < scopeKings.size(); s++)
+		{
+			auto& scope = scopeKings[s];
+			auto size = scope.declarations.Size();
+			auto keys = scope.declarations.Keys();
+			auto data = scope.declarations.Declarations();
+
+			auto& copy = scopes.emplace_back();
+			for (size_t i = 0; i < size; i++)
+				copy.push_back({ keys[i], data[i] });
+
+			histogram[size == 0 ? 0 : size <= 4 ? 1 : size <= 16 ? 2 : size <= 64 ? 3 : size <= 256 ? 4 : 5]++;
+			lookups += size;
+			if (scopes.size() > 1)
+				lookups += scopes[scopes.size() - 2].size();
+		}
+	}
+
+	std::cout << "scope maps: " << scopes.size() << " scopes, sizes 0: " << histogram[0] << ", 1-4: " << histogram[1] << ", 5-16: " << histogram[2]
+		<< ", 17-64: " << histogram[3] << ", 65-256: " << histogram[4] << ", more: " << histogram[5] << "\n";
+
+	long long stbBuild, stbLookup, flatBuild, flatLookup;
+	uint64_t stbFound = 0, flatFound = 0;
+	BuildAndLookUp<StbScopemap>(scopes, rounds, &stbBuild, &stbLookup, &stbFound);
+	BuildAndLookUp<Scopemap>(scopes, rounds, &flatBuild, &flatLookup, &flatFound);
+
+	auto rate = [&](long long time) { return (double)(lookups * rounds) / (double)std::max(time, 1LL); };
+	std::cout << "stb_ds: built in " << stbBuild << "us, " << rate(stbLookup) << " million lookups/s\n";
+	std::cout << "flat: built in " << flatBuild << "us, " << rate(flatLookup) << " million lookups/s\n";
+	std::cout << "results match: " << (stbFound == flatFound ? "yes" : "NO") << "\n";
+}
+
+
+static void CompletionBenchmark(int lines, int rounds)
+{
+	// a module's file scope with about a quarter of it exported, in runs, the way #scope_file and #scope_export split one up.
+	std::string code;
+	char line[128];
+	bool exporting = true;
+	for (int i = 0; i < lines; i++)
+	{
+		auto exportRun = ((i / 8) * 2654435761u >> 16) % 4 == 0;
+		if (exportRun != exporting)
+		{
+			exporting = exportRun;
+			code.append(exporting ? "#scope_export\n" : "#scope_file\n");
+		}
+
+		snprintf(line, sizeof(line), "proc_%d :: (a: int, b: float) -> int { return a + %d; }\n", i, i);
+		code.append(line);
+	}
+
+	auto documentPath = "completion_benchmark.jai";
+	CreateTree(documentPath, code.c_str(), (int)code.length());
+	auto fileScope = GetDocument(StringHash(documentPath))->fileScope;
+	auto scope = fileScope->GetScope(fileScope->file);
+
+	std::cout << "completion lists: " << scope->declarations.Size() << " declarations in the module scope, " << rounds << " rounds\n";
+	std::cout << "\tus per exported list\tus per full list\tus per check\n";
+
+	std::string exported;
+	auto timer = Timer("");
+	for (int i = 0; i < rounds; i++)
+	{
+		exported.clear();
+		scope->AppendExportedMembers(exported, fileScope->buffer, fileScope->shiftLog);
+	}
+	auto exportedTime = timer.GetMicroseconds();
+
+	std::string all;
+	timer = Timer("");
+	for (int i = 0; i < rounds; i++)
+	{
+		all.clear();
+		scope->AppendMembers(all, fileScope->buffer, fileScope->shiftLog);
+	}
+	auto allTime = timer.GetMicroseconds();
+
+	// everything's evaluated after the first, so this is just the scan for what's left to do.
+	timer = Timer("");
+	for (int i = 0; i < rounds; i++)
+		fileScope->CheckScope(scope);
+	auto checkTime = timer.GetMicroseconds();
+
+	std::cout << "column\t" << exportedTime / rounds << "\t\t\t" << allTime / rounds << "\t\t\t" << checkTime / rounds << "\n";
+
+	// the flags column against the flags in the declarations themselves.
+	size_t fromColumn = 0, fromRecords = 0;
+	auto size = scope->declarations.Size();
+	auto declarations = scope->declarations.Declarations();
+	for (size_t first = 0; first < size; first += 16)
+		fromColumn += std::popcount(scope->declarations.MatchFlags(first, DeclarationFlags::Exported, DeclarationFlags::Exported));
+	for (size_t i = 0; i < size; i++)
+		fromRecords += declarations[i].HasFlags(DeclarationFlags::Exported);
+
+	std::cout << "exported counts match: " << (fromColumn == fromRecords ? "yes" : "NO") << ", " << exported.size() << " bytes\n";
+}
+
+
+// what's in the memo, the declarations that had their type when they were found never go through it.
+static size_t CountEvaluated(FileScope* fileScope)
+{
+	return fileScope->memo.CountEvaluated();
+}
+
+static void InferenceBenchmark(int lines, int queries)
+{
+	// variables typed from calls all over a file. checking leaves their types for the queries that ask for them.
+	std::string code = MakeSyntheticFile(lines);
+	char line[128];
+	for (int i = 0; i < lines; i++)
+	{
+		snprintf(line, sizeof(line), "value_%d := proc_%d(1, 2.0);\n", i, i);
+		code.append(line);
+	}
+
+	// cycles that used to recurse until the stack ran out.
+	code.append("first :: second;\nsecond :: first;\n");
+	code.append("Ping :: struct { using pong: Pong; ping_field: int; }\nPong :: struct { using ping: Ping; pong_field: float; }\n");
+
+	auto documentPath = "inference_benchmark.jai";
+	CreateTree(documentPath, code.c_str(), (int)code.length());
+	auto fileScope = GetDocument(StringHash(documentPath))->fileScope;
+
+	std::cout << "type inference: " << lines << " variables, " << queries << " queries\n";
+
+	fileScope->status = FileScope::Status::dirty;
+	fileScope->Build();
+	fileScope->WaitForDependencies();
+
+	auto timer = Timer("");
+	fileScope->DoTypeCheckingAndInference(fileScope->currentTree);
+	auto checkTime = timer.GetMicroseconds();
+	auto evaluated = CountEvaluated(fileScope);
+
+	// what a hover over some of the variables would ask for.
+	auto scope = fileScope->GetScope(fileScope->file);
+	size_t typed = 0;
+	timer = Timer("");
+	for (int i = 0; i < queries; i++)
+	{
+		auto name = "value_" + std::to_string((i * 7919) % lines);
+		auto type = fileScope->InferDeclarationType(scope, scope->GetIndex(IdentifierHash(name)));
+		typed += type && fileScope->GetType(*type)->name.size() > 0;
+	}
+	auto queryTime = timer.GetMicroseconds();
+
+	std::cout << "\tus to check\tevaluated after\tus per query\n";
+	std::cout << "\t" << checkTime << "\t\t" << evaluated << "\t\t" << queryTime / std::max(queries, 1) << "\n";
+
+	auto cycle = fileScope->InferDeclarationType(scope, scope->GetIndex(IdentifierHash("first")));
+	auto ping = fileScope->GetScope(scope->TryGet(IdentifierHash("Ping"))->type.scope);
+	auto pong = fileScope->GetScope(scope->TryGet(IdentifierHash("Pong"))->type.scope);
+
+	std::cout << "every queried variable has its type: " << (typed == (size_t)queries ? "yes" : "NO") << "\n";
+	std::cout << "a :: b; b :: a; has no type: " << (!cycle ? "yes" : "NO") << "\n";
+	std::cout << "structs using each other see each other's fields: "
+		<< (ping->TryGet(IdentifierHash("pong_field")) && pong->TryGet(IdentifierHash("ping_field")) ? "yes" : "NO") << "\n";
+}
+
+
+static void LoadThroughputBenchmark(int files, int linesPerFile)
+{
+	// a tree of files where every file #loads the next eight, written out to disk and loaded from the top like an import would be.
+	auto directory = std::filesystem::temp_directory_path() / "jai-lsp-load-benchmark";
+	std::filesystem::create_directories(directory);
+
+	auto body = MakeSyntheticFile(linesPerFile);
+	size_t totalBytes = 0;
+	for (int i = 0; i < files; i++)
+	{
+		std::string code;
+		for (int child = i * 8 + 1; child <= i * 8 + 8 && child < files; child++)
+		{
+			code += "#load \"file_" + std::to_string(child) + ".jai\";\n";
+		}
+		code += body;
+		totalBytes += code.length();
+
+		std::ofstream out(directory / ("file_" + std::to_string(i) + ".jai"), std::ios::binary);
+		out << code;
+	}
+
+	auto root = (directory / "file_0.jai").string();
+	auto timer = Timer("");
+	CreateTreeFromPath(root.c_str(), "load_benchmark");
+	WaitForLoads();
+	auto time = timer.GetMicroseconds();
+
+	int workers;
+	uint64_t executed, stolen, helped;
+	GetTaskStats(&workers, &executed, &stolen, &helped);
+
+	std::cout << "load throughput: " << files << " files, " << totalBytes / 1024 << " KB, " << workers << " workers\n";
+	std::cout << "loaded in " << time / 1000 << "ms, " << (int)(files / (time / 1000000.0)) << " files/s\n";
+	std::cout << "tasks run: " << executed << ", stolen: " << stolen << ", run while waiting: " << helped << "\n";
+
+	// loaded files are lazy, the scopes in their function bodies are never made.
+	size_t scopes = 0;
+	for (size_t i = 0; i < g_fileScopeByIndex.size(); i++)
+	{
+		scopes += g_fileScopeByIndex.Read(i)->scopeKings.size();
+	}
+	std::cout << "scopes: " << scopes << "\n";
+
+	uint64_t identifiers, identifierBytes, lookups, hits;
+	GetIdentifierStats(&identifiers, &identifierBytes, &lookups, &hits);
+	std::cout << "identifiers: " << identifiers << " in " << identifierBytes / 1024 << " KB, " << lookups << " lookups, "
+		<< (lookups ? hits * 100 / lookups : 0) << "% already interned\n";
+
+	// checking the root checks the whole tree first, a level of the tree at a time.
+	SemanticToken* tokens;
+	int count;
+	timer = Timer("");
+	GetTokens(StringHash(root).value, &tokens, &count);
+	std::cout << "type checked in " << timer.GetMicroseconds() / 1000 << "ms\n";
+}
+
 int main()
 {
 
@@ -223,6 +979,18 @@ int main()
 	//	CreateTree("zebra", code, strlen(code));
 
 	//ParseModules(30);
+	//TextStoreBenchmark(20000, 2000);
+	//ReparseBenchmark(20000, 10);
+	//NewlineScanBenchmark(500, 2000);
+	//HashBenchmark(256);
+	//IncrementalAnalysisCheck(2000, 200);
+	//DictionaryContentionBenchmark(500, 500);
+	//LoadThroughputBenchmark(600, 200);
+	//ParseModules(1); ScopemapBenchmark(20);
+	//ArenaBenchmark(5000, 50);
+	//HandleLimitsCheck();
+	//CompletionBenchmark(50000, 200);
+	//InferenceBenchmark(20000, 1000);
 
 }
 
@@ -0,0 +1,193 @@
+#include "AnalysisScheduler.h"
+#include "FileScope.h"
+
+
+AnalysisScheduler g_analysis;
+
+// how long a worker parses before checking if it should stop.
+static constexpr uint64_t parseSliceMicros = 50000;
+
+// the server calls StopAnalysis before it exits, this is for when it didn't.
+AnalysisScheduler::~AnalysisScheduler()
+{
+	Stop();
+}
+
+void AnalysisScheduler::Start(int workerCount, int quietWindowMillis)
+{
+	std::lock_guard lock(mutex);
+	if (started)
+		return;
+
+	started = true;
+	stopping = false;
+	quietWindow = std::chrono::milliseconds(quietWindowMillis);
+
+	for (int i = 0; i < workerCount; i++)
+	{
+		workers.emplace_back([this] { WorkerLoop(); });
+	}
+}
+
+void AnalysisScheduler::Stop()
+{
+	{
+		std::lock_guard lock(mutex);
+		if (!started)
+			return;
+
+		stopping = true;
+	}
+
+	workAvailable.notify_all();
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+
+	std::lock_guard lock(mutex);
+	workers.clear();
+	pending.clear();
+	started = false;
+	analysisDone.notify_all();
+}
+
+void AnalysisScheduler::Schedule(Hash document)
+{
+	{
+		std::lock_guard lock(mutex);
+		if (!started)
+			return;
+
+		pending[document] = Clock::now() + quietWindow;
+	}
+
+	workAvailable.notify_one();
+}
+
+// analyzed means a snapshot of that generation is out, not just that the scopes are checked.
+bool AnalysisScheduler::IsAnalyzed(Hash document, uint64_t generation)
+{
+	auto record = GetDocument(document);
+	return record->snapshot && record->snapshot->generation >= generation;
+}
+
+void AnalysisScheduler::WaitForGeneration(Hash document, uint64_t generation)
+{
+	auto record = GetDocument(document);
+	if (!record || !record->fileScope)
+		return;
+
+	std::unique_lock lock(mutex);
+
+	// the quiet window is there to wait out typing. someone asking for the results means the typing is done.
+	if (auto it = pending.find(document); it != pending.end() && !IsAnalyzed(document, generation))
+	{
+		it->second = Clock::now();
+		workAvailable.notify_all();
+	}
+
+	analysisDone.wait(lock, [&] {
+		if (IsAnalyzed(document, generation))
+			return true;
+
+		// nobody is going to do it, the caller does its own checking like before.
+		return !started || (!pending.contains(document) && !running.contains(document));
+	});
+}
+
+void AnalysisScheduler::WaitForLatest(Hash document)
+{
+	if (auto record = GetDocument(document); record && record->fileScope)
+	{
+		WaitForGeneration(document, record->fileScope->journal.Generation());
+	}
+}
+
+SnapshotRecord AnalysisScheduler::LatestSnapshot(Hash document)
+{
+	WaitForLatest(document);
+
+	auto record = GetDocument(document);
+	if (!record || !record->fileScope)
+		return nullptr;
+
+	auto snapshot = record->snapshot;
+	if (!snapshot || snapshot->generation != record->fileScope->builtGeneration)
+	{
+		// the scopes are being rebuilt right now if this doesn't publish, the last version is still consistent.
+		if (auto published = record->fileScope->PublishSnapshot())
+			snapshot = published;
+	}
+
+	// one restored from the index cache is only there for the files that depend on it, there's no tree to query.
+	if (snapshot && !snapshot->tree)
+		return nullptr;
+
+	return snapshot;
+}
+
+void AnalysisScheduler::WorkerLoop()
+{
+	std::unique_lock lock(mutex);
+
+	while (!stopping)
+	{
+		// take the document whose quiet window ends first. a document that's already being analyzed
+		// waits for that to finish, it gets picked up again after.
+		Hash next = {};
+		auto earliest = Clock::time_point::max();
+		for (auto& [document, deadline] : pending)
+		{
+			if (!running.contains(document) && deadline < earliest)
+			{
+				next = document;
+				earliest = deadline;
+			}
+		}
+
+		if (earliest == Clock::time_point::max())
+		{
+			workAvailable.wait(lock);
+			continue;
+		}
+
+		if (earliest > Clock::now())
+		{
+			workAvailable.wait_until(lock, earliest);
+			continue;
+		}
+
+		pending.erase(next);
+		running.insert(next);
+		lock.unlock();
+
+		Analyze(next);
+
+		lock.lock();
+		running.erase(next);
+		analysisDone.notify_all();
+		workAvailable.notify_all();
+	}
+}
+
+void AnalysisScheduler::Analyze(Hash document)
+{
+	auto record = GetDocument(document);
+	if (!record || !record->fileScope)
+		return;
+
+	// the type checking below only reads the tree and text the scopes were built from, which are the file's own copies.
+	// edits go to the live tree, and a rebuild of the file waits for a check of it to finish.
+	ParseStatus status;
+	do
+	{
+		status = ReparseAndRebuild(document, parseSliceMicros);
+	} while (status == ParseStatus::timedOut && !stopping);
+
+	// cancelled means an edit came in, and that edit has scheduled the document again.
+	if (status != ParseStatus::done)
+		return;
+
+	record->fileScope->PublishSnapshot();
+}
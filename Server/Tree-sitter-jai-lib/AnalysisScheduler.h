@@ -0,0 +1,63 @@
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+
+#include "Hash.h"
+#include "Document.h"
+
+struct FileScope;
+
+
+// runs reparse -> Build -> type checking for edited documents on worker threads.
+// edits just mark the document, the analysis starts once the document has been quiet for a while,
+// so a burst of typing turns into one analysis. queries wait until the analysis has caught up with
+// the edits they've seen, instead of everything running on the didChange thread.
+struct AnalysisScheduler
+{
+	using Clock = std::chrono::steady_clock;
+
+	std::mutex mutex;
+	std::condition_variable workAvailable;
+	std::condition_variable analysisDone;
+
+	std::unordered_map<Hash, Clock::time_point> pending; // document -> end of its quiet window
+	std::unordered_set<Hash> running;
+	std::vector<std::thread> workers;
+	Clock::duration quietWindow;
+	bool started = false;
+	std::atomic<bool> stopping = false;
+
+	~AnalysisScheduler();
+
+	void Start(int workerCount, int quietWindowMillis);
+	void Stop();
+
+	// (re)starts the quiet window of the document.
+	void Schedule(Hash document);
+
+	// blocks until the document has been analyzed up to the given edit generation, a queued analysis of it starts right away.
+	// returns straight away if nothing is queued that could get it there.
+	void WaitForGeneration(Hash document, uint64_t generation);
+
+	// waits for every edit made to the document so far.
+	void WaitForLatest(Hash document);
+
+	// waits for the latest edits, then hands out the snapshot they were analyzed into.
+	// when nothing analyzes the document in the background the caller does it, like before.
+	// null if the document has never been analyzed.
+	SnapshotRecord LatestSnapshot(Hash document);
+
+private:
+	void WorkerLoop();
+	void Analyze(Hash document);
+	bool IsAnalyzed(Hash document, uint64_t generation);
+};
+
+extern AnalysisScheduler g_analysis;
@@ -0,0 +1,66 @@
+#include "Arena.h"
+#include "TreeSitterJai.h"
+
+#include <stdlib.h>
+
+
+AllocationStats g_allocationStats;
+
+Arena::~Arena()
+{
+	for (auto& chunk : chunks)
+		free(chunk.data);
+}
+
+void* Arena::Allocate(size_t bytes, size_t alignment)
+{
+	g_allocationStats.arena.fetch_add(1, std::memory_order_relaxed);
+
+	// chunks left over from before a reset get used up in order, one too small for this gets skipped.
+	for (; current < chunks.size(); current++, used = 0)
+	{
+		auto& chunk = chunks[current];
+		auto start = (used + alignment - 1) & ~(alignment - 1);
+		if (start + bytes <= chunk.size)
+		{
+			used = start + bytes;
+			return chunk.data + start;
+		}
+	}
+
+	// malloc hands out memory aligned for anything, so the start of a chunk is aligned already.
+	auto size = chunks.empty() ? minimumChunkSize : chunks.back().size * 2;
+	while (size < bytes)
+		size *= 2;
+
+	chunks.push_back({ (char*)malloc(size), size });
+	g_allocationStats.chunks.fetch_add(1, std::memory_order_relaxed);
+
+	current = chunks.size() - 1;
+	used = bytes;
+	return chunks.back().data;
+}
+
+// the chunks stay, each one is twice the size of the one before so a file that's about as big as last time fits in them again.
+void Arena::Reset()
+{
+	current = 0;
+	used = 0;
+}
+
+size_t Arena::Capacity() const
+{
+	size_t size = 0;
+	for (auto& chunk : chunks)
+		size += chunk.size;
+
+	return size;
+}
+
+
+export_jai_lsp void GetAllocationStats(uint64_t* outHeap, uint64_t* outArena, uint64_t* outChunks)
+{
+	*outHeap = g_allocationStats.heap;
+	*outArena = g_allocationStats.arena;
+	*outChunks = g_allocationStats.chunks;
+}
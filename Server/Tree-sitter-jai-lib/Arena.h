@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+
+// what the scope tables of every file cost, for the benchmark.
+struct AllocationStats
+{
+	std::atomic<uint64_t> heap = 0; // a malloc of its own, with a free of its own to come
+	std::atomic<uint64_t> arena = 0; // bumped out of an arena
+	std::atomic<uint64_t> chunks = 0; // mallocs the arenas made to get more room
+};
+
+extern AllocationStats g_allocationStats;
+
+
+// a bump allocator. nothing that comes out of it is freed by itself, Reset lets go of all of it at once and keeps the memory
+// for the next time round. it's only ever used by whoever's building the scopes it belongs to, so it doesn't lock.
+class Arena
+{
+	struct Chunk
+	{
+		char* data;
+		size_t size;
+	};
+
+	static constexpr size_t minimumChunkSize = 16 * 1024;
+
+	std::vector<Chunk> chunks;
+	size_t current = 0; // the chunk being bumped
+	size_t used = 0; // how much of it
+
+public:
+	Arena() = default;
+	~Arena();
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	void* Allocate(size_t bytes, size_t alignment = alignof(max_align_t));
+	void Reset();
+	size_t Capacity() const;
+};
@@ -1,9 +1,18 @@
 #include "TreeSitterJai.h"
 #include "FileScope.h"
+#include "AnalysisScheduler.h"
 
 TSNode ConstructRhsFromDecl(ScopeDeclaration decl, TSTree* tree);
 
 
+// a file found through a load or an import. its names come from the query's snapshot of it, and so does the text they're read from.
+static void AppendExportsOf(std::string& str, FileScope* found)
+{
+	auto file = GetFileScope(found->fileIndex);
+	file->GetScope(file->file)->AppendExportedMembers(str, file->buffer, file->shiftLog);
+}
+
+
 enum InvocationType
 {
 	Invoked = 1,
@@ -19,22 +28,15 @@ export_jai_lsp const char* GetCompletionItems(uint64_t hashValue, int row, int c
 	static std::string str;
 	str.clear();
 
-	auto tree = ts_tree_copy(g_trees.Read(documentHash).value());
-	auto root = ts_tree_root_node(tree);
-	auto buffer = g_buffers.Read(documentHash).value();
-	auto fileScope = g_fileScopes.Read(documentHash).value();
-
-	if (fileScope->status == FileScope::Status::scopesBuilt)
-	{
-		fileScope->WaitForDependencies();
-		fileScope->DoTypeCheckingAndInference(tree);
-
-		fileScope->status = FileScope::Status::checked;
-	}
-	else if (fileScope->status != FileScope::Status::checked)
-	{
+	auto snapshot = g_analysis.LatestSnapshot(documentHash);
+	if (!snapshot)
 		return nullptr;
-	}
+
+	SnapshotPin pin(snapshot.get());
+	auto tree = snapshot->tree.get();
+	auto root = ts_tree_root_node(tree);
+	auto buffer = snapshot->text.get();
+	auto fileScope = snapshot->analysis.get();
 
 
 
@@ -85,7 +87,7 @@ export_jai_lsp const char* GetCompletionItems(uint64_t hashValue, int row, int c
 
 		while (scope)
 		{
-			scope->AppendMembers(str, buffer);
+			scope->AppendMembers(str, buffer, fileScope->shiftLog);
 			scope = fileScope->GetScope(scope->parent);
 		}
 
@@ -100,13 +102,12 @@ export_jai_lsp const char* GetCompletionItems(uint64_t hashValue, int row, int c
 		// and append loads
 		for (auto load : fileScope->loads)
 		{
-			if (auto loadedScope = g_fileScopes.Read(load))
+			if (auto loaded = GetDocument(load); loaded && loaded->fileScope)
 			{
-				if ((*loadedScope)->fileIndex == 0) // skip built in scope.
+				if (loaded->fileScope->fileIndex == 0) // skip built in scope.
 					continue;
 
-				auto loadedBuffer = g_buffers.Read(load).value();
-				(*loadedScope)->GetScope((*loadedScope)->file)->AppendExportedMembers(str, loadedBuffer);
+				AppendExportsOf(str, loaded->fileScope);
 			}
 		}
 
@@ -115,21 +116,18 @@ export_jai_lsp const char* GetCompletionItems(uint64_t hashValue, int row, int c
 		{
 			if (auto mod = g_modules.Read(import))
 			{
-				auto moduleFile = mod.value()->moduleFile;
-				auto mfHash = mod.value()->moduleFileHash;
-				auto importedBuffer = g_buffers.Read(mfHash).value();
-				moduleFile->GetScope(moduleFile->file)->AppendExportedMembers(str, importedBuffer);
+				auto moduleFile = GetFileScope(mod.value()->moduleFile->fileIndex);
+				AppendExportsOf(str, moduleFile);
 
 				// and double finally append all exported member for each loaded file.
 				for (auto load : moduleFile->loads)
 				{
-					if (auto loadedScope = g_fileScopes.Read(load))
+					if (auto loaded = GetDocument(load); loaded && loaded->fileScope)
 					{
-						if ((*loadedScope)->fileIndex == 0) // skip built in scope.
+						if (loaded->fileScope->fileIndex == 0) // skip built in scope.
 							continue;
 
-						auto loadedBuffer = g_buffers.Read(load).value();
-						(*loadedScope)->GetScope((*loadedScope)->file)->AppendExportedMembers(str, loadedBuffer);
+						AppendExportsOf(str, loaded->fileScope);
 					}
 				}
 			}
@@ -146,12 +144,12 @@ export_jai_lsp const char* GetCompletionItems(uint64_t hashValue, int row, int c
 	{
 		if (auto type = GetType(*typeHandle) )
 		{
-			auto memberScope = g_fileScopeByIndex.Read(typeHandle->fileIndex)->GetScope(typeHandle->scope);
+			auto typeFile = GetFileScope(typeHandle->fileIndex);
+			auto memberScope = typeFile->GetScope(typeHandle->scope);
 			if (memberScope == nullptr)
 				return nullptr;
 	
-			auto bufferForType = g_fileScopeByIndex.Read(typeHandle->fileIndex)->buffer;
-			memberScope->AppendMembers(str, bufferForType);
+			memberScope->AppendMembers(str, typeFile->buffer, typeFile->shiftLog);
 
 			return str.c_str();
 		}
@@ -170,7 +168,7 @@ export_jai_lsp const char* GetCompletionItems(uint64_t hashValue, int row, int c
 		auto found = GetScopeAndParentForNode(node, fileScope, &parent, &scope);
 		if (found)
 		{
-			fileScope->GetScope(scope)->AppendMembers(str, buffer);
+			fileScope->GetScope(scope)->AppendMembers(str, buffer, fileScope->shiftLog);
 			TSNode scopeScopeParent;
 			ScopeHandle scopeScope;
 			found = GetScopeAndParentForNode(parent, fileScope, &scopeScopeParent, &scopeScope);
@@ -178,24 +176,23 @@ export_jai_lsp const char* GetCompletionItems(uint64_t hashValue, int row, int c
 
 			while (found)
 			{
-				fileScope->GetScope(scopeScope)->AppendMembers(str, buffer);
+				fileScope->GetScope(scopeScope)->AppendMembers(str, buffer, fileScope->shiftLog);
 				found = GetScopeAndParentForNode(scopeScopeParent, fileScope, &scopeScopeParent, &scopeScope);
 			}
 
 			// and append whatever is in file scope for good measure
 			if(!foundAnything)
-				fileScope->GetScope(fileScope->file)->AppendMembers(str, buffer);
+				fileScope->GetScope(fileScope->file)->AppendMembers(str, buffer, fileScope->shiftLog);
 
 			// and append loads
 			for (auto load : fileScope->loads)
 			{
-				if (auto loadedScope = g_fileScopes.Read(load))
+				if (auto loaded = GetDocument(load); loaded && loaded->fileScope)
 				{
-					if ((*loadedScope)->fileIndex == 0) // skip built in scope.
+					if (loaded->fileScope->fileIndex == 0) // skip built in scope.
 						continue;
 
-					auto loadedBuffer = g_buffers.Read(load).value();
-					(*loadedScope)->GetScope((*loadedScope)->file)->AppendExportedMembers(str, loadedBuffer);
+					AppendExportsOf(str, loaded->fileScope);
 				}
 			}
 
@@ -204,21 +201,18 @@ export_jai_lsp const char* GetCompletionItems(uint64_t hashValue, int row, int c
 			{
 				if (auto mod = g_modules.Read(import))
 				{
-					auto moduleFile = mod.value()->moduleFile;
-					auto mfHash = mod.value()->moduleFileHash;
-					auto importedBuffer = g_buffers.Read(mfHash).value();
-					moduleFile->GetScope(moduleFile->file)->AppendExportedMembers(str, importedBuffer);
+					auto moduleFile = GetFileScope(mod.value()->moduleFile->fileIndex);
+					AppendExportsOf(str, moduleFile);
 
 					// and double finally append all exported member for each loaded file.
 					for (auto load : moduleFile->loads)
 					{
-						if (auto loadedScope = g_fileScopes.Read(load))
+						if (auto loaded = GetDocument(load); loaded && loaded->fileScope)
 						{
-							if ((*loadedScope)->fileIndex == 0) // skip built in scope.
+							if (loaded->fileScope->fileIndex == 0) // skip built in scope.
 								continue;
 
-							auto loadedBuffer = g_buffers.Read(load).value();
-							(*loadedScope)->GetScope((*loadedScope)->file)->AppendExportedMembers(str, loadedBuffer);
+							AppendExportsOf(str, loaded->fileScope);
 						}
 					}
 
@@ -1,48 +1,172 @@
 #pragma once
 #include <shared_mutex>
-#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <type_traits>
 #include <vector>
 #include <optional>
 
 #include "Hash.h"
 
 
+// the global tables get read on every request, many times over, and written a lot less.
+// reads never lock or wait: slots are atomics, and a writer fills in the value before it publishes the key.
+// writers take a mutex between themselves. there is no remove, so a key never leaves its slot.
+// growing publishes a new table, but readers may still be probing the old one, so it is kept until the dictionary goes away.
+// tables double, so the old ones never add up to more than the live one.
+// values that don't fit in an atomic are boxed, boxes are kept around the same way.
 template <typename T>
 struct ConcurrentDictionary
 {
-	std::shared_mutex mutex;
-	std::unordered_map<Hash, T> dict;
+	static constexpr bool inlineValue = std::is_trivially_copyable_v<T> && sizeof(T) <= sizeof(uint64_t);
+	using Stored = std::conditional_t<inlineValue, T, const T*>;
 
-	std::optional<T> Read(Hash key)
+	struct Slot
 	{
-		mutex.lock_shared();
-		auto it = dict.find(key);
+		std::atomic<uint64_t> key; // 0 is empty, the zero hash goes in zeroSlot instead
+		std::atomic<Stored> value;
+	};
 
-		if (it == dict.end())
-		{
-			mutex.unlock_shared();
+	struct Table
+	{
+		size_t mask;
+		std::unique_ptr<Slot[]> slots;
+	};
+
+	std::atomic<Table*> table;
+	Slot zeroSlot{};
+	std::atomic<size_t> count = 0;
+
+	std::mutex writeMutex;
+	std::vector<std::unique_ptr<Table>> tables; // the live one is at the back
+	std::vector<std::unique_ptr<const T>> boxes;
+
+	ConcurrentDictionary()
+	{
+		tables.push_back(NewTable(64));
+		table = tables.back().get();
+	}
+
+	ConcurrentDictionary(const ConcurrentDictionary&) = delete;
+	ConcurrentDictionary& operator=(const ConcurrentDictionary&) = delete;
+
+	std::optional<T> Read(Hash key)
+	{
+		auto slot = Find(table.load(std::memory_order_acquire), key.value);
+		if (!slot)
 			return std::nullopt;
-		}
 
-		auto value = it->second;
-		mutex.unlock_shared();
-		return std::optional(value);
+		auto value = slot->value.load(std::memory_order_acquire);
+		if constexpr (inlineValue)
+			return std::optional(value);
+		else
+			return std::optional(*value);
 	}
 
 	void Write(Hash key, T value)
 	{
-		mutex.lock();
-		dict[key] = value;
-		mutex.unlock();
+		std::lock_guard<std::mutex> lock(writeMutex);
+
+		auto current = table.load(std::memory_order_relaxed);
+		if (auto slot = Find(current, key.value))
+		{
+			Store(*slot, value);
+			return;
+		}
+
+		// keep at least half the slots empty so probes stay short, and always end.
+		if ((count.load(std::memory_order_relaxed) + 1) * 2 > current->mask + 1)
+			current = Grow(current);
+
+		auto slot = key.value == 0 ? &zeroSlot : EmptySlot(current, key.value);
+		Store(*slot, value);
+		slot->key.store(key.value == 0 ? 1 : key.value, std::memory_order_release);
+		count.fetch_add(1, std::memory_order_relaxed);
 	}
 
 	size_t size()
 	{
-		mutex.lock();
-		auto size = dict.size();
-		mutex.unlock();
+		return count.load(std::memory_order_relaxed);
+	}
 
-		return size;
+private:
+
+	static size_t Index(uint64_t key, size_t mask)
+	{
+		// fibonacci hashing, spreads hashes that only differ in the high bits.
+		return (size_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+	}
+
+	static std::unique_ptr<Table> NewTable(size_t capacity)
+	{
+		auto newTable = std::make_unique<Table>();
+		newTable->mask = capacity - 1;
+		newTable->slots = std::unique_ptr<Slot[]>(new Slot[capacity]());
+		return newTable;
+	}
+
+	Slot* Find(Table* current, uint64_t key)
+	{
+		if (key == 0)
+			return zeroSlot.key.load(std::memory_order_acquire) ? &zeroSlot : nullptr;
+
+		for (auto i = Index(key, current->mask);; i = (i + 1) & current->mask)
+		{
+			auto slotKey = current->slots[i].key.load(std::memory_order_acquire);
+			if (slotKey == key)
+				return &current->slots[i];
+
+			if (slotKey == 0)
+				return nullptr;
+		}
+	}
+
+	static Slot* EmptySlot(Table* current, uint64_t key)
+	{
+		auto i = Index(key, current->mask);
+		while (current->slots[i].key.load(std::memory_order_relaxed) != 0)
+			i = (i + 1) & current->mask;
+
+		return &current->slots[i];
+	}
+
+	void Store(Slot& slot, const T& value)
+	{
+		if constexpr (inlineValue)
+		{
+			slot.value.store(value, std::memory_order_release);
+		}
+		else
+		{
+			// documents get written with the same path over and over, no need for a new box each time.
+			auto old = slot.value.load(std::memory_order_relaxed);
+			if (old && *old == value)
+				return;
+
+			boxes.push_back(std::make_unique<const T>(value));
+			slot.value.store(boxes.back().get(), std::memory_order_release);
+		}
+	}
+
+	Table* Grow(Table* current)
+	{
+		tables.push_back(NewTable((current->mask + 1) * 2));
+		auto next = tables.back().get();
+
+		for (size_t i = 0; i <= current->mask; i++)
+		{
+			auto key = current->slots[i].key.load(std::memory_order_relaxed);
+			if (key == 0)
+				continue;
+
+			auto slot = EmptySlot(next, key);
+			slot->value.store(current->slots[i].value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			slot->key.store(key, std::memory_order_relaxed);
+		}
+
+		table.store(next, std::memory_order_release);
+		return next;
 	}
 };
 
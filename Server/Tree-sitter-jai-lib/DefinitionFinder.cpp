@@ -1,5 +1,6 @@
 #include "TreeSitterJai.h"
 #include "FileScope.h"
+#include "AnalysisScheduler.h"
 
 
 
@@ -26,16 +27,23 @@ export_jai_lsp void FindDefinition(uint64_t hashValue, int row, int col, uint64_
 {
 	auto documentName = Hash{ .value = hashValue };
 
+	auto snapshot = g_analysis.LatestSnapshot(documentName);
+	if (!snapshot)
+	{
+		*outFileHash = 0;
+		return;
+	}
 
-	auto tree = ts_tree_copy(g_trees.Read(documentName).value());
+	SnapshotPin pin(snapshot.get());
+	auto tree = snapshot->tree.get();
 	auto root = ts_tree_root_node(tree);
-	auto buffer = g_buffers.Read(documentName).value();;
-	auto fileScope = g_fileScopes.Read(documentName).value();
+	auto buffer = snapshot->text.get();
+	auto fileScope = snapshot->analysis.get();
 
 	auto point = TSPoint{ static_cast<uint32_t>(row), static_cast<uint32_t>(col) };
 
 	auto identifierNode = ts_node_named_descendant_for_point_range(root, point, point);
-	auto identifierHash = GetIdentifierHash(identifierNode, buffer);
+	auto identifierHash = FindIdentifierHash(identifierNode, buffer);
 	*outOriginRange = NodeToRange(identifierNode);
 
 	if (FileScope::builtInScope->TryGet(identifierHash))
@@ -53,10 +61,21 @@ export_jai_lsp void FindDefinition(uint64_t hashValue, int row, int col, uint64_
 	{
 		*outFileHash = declFile->documentHash.value;
 		auto decl = declScope->GetDeclFromIndex(declIndex);
+		auto declStart = declFile->DeclarationStart(declScope, *decl);
+
+		if (!declFile->currentTree)
+		{
+			// restored from the index cache, there's no tree to find the node in. the name is all we can point at.
+			auto start = declFile->buffer->GetPoint(declStart);
+			auto end = declFile->buffer->GetPoint(declStart + decl->GetLength());
+			*outSelectionRange = PointsToRange(start, end);
+			*outTargetRange = *outSelectionRange;
+			return;
+		}
 
 		// wow this is dumb but we're going to query the tree to get the node for the declaration offset! hope that offset isn't stale!
 		auto declRoot = ts_tree_root_node(declFile->currentTree);
-		auto definitionNode = ts_node_named_descendant_for_byte_range(declRoot, decl->startByte, decl->startByte + decl->GetLength());
+		auto definitionNode = ts_node_named_descendant_for_byte_range(declRoot, declStart, declStart + decl->GetLength());
 		*outSelectionRange = NodeToRange(definitionNode);
 
 		auto parent = ts_node_parent(definitionNode);
@@ -65,7 +84,6 @@ export_jai_lsp void FindDefinition(uint64_t hashValue, int row, int col, uint64_
 		else
 			*outTargetRange = { 0 };
 
-		ts_tree_delete(tree);
 		return;
 	}
 
@@ -193,5 +211,4 @@ export_jai_lsp void FindDefinition(uint64_t hashValue, int row, int col, uint64_
 
 	*/
 	*outFileHash = 0;
-	ts_tree_delete(tree);
 }
\ No newline at end of file
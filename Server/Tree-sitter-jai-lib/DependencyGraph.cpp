@@ -0,0 +1,225 @@
+#include "DependencyGraph.h"
+#include "FileScope.h"
+
+#include <algorithm>
+
+
+int DependencyGraph::Add(FileScope* file)
+{
+	auto [it, added] = fileToIndex.try_emplace(file, (int)files.size());
+	if (added)
+	{
+		files.push_back(file);
+		dependencies.emplace_back();
+	}
+
+	return it->second;
+}
+
+DependencyGraph DependencyGraph::Collect(FileScope* root)
+{
+	DependencyGraph graph;
+	graph.Add(root);
+
+	// files get added to the end as they're found, so this is a breadth first walk.
+	for (size_t i = 0; i < graph.files.size(); i++)
+	{
+		auto file = graph.files[i];
+
+		// another thread may be building this file, it holds the file's check lock until the scopes are done.
+		// the loads are waited on after letting go, one of them could be a build of this file.
+		std::vector<TaskHandle> loadTasks;
+		std::vector<Hash> loads;
+		std::vector<Hash> imports;
+		{
+			std::lock_guard lock(file->checkMutex);
+			loadTasks = file->loadTasks;
+			loads = file->loads;
+			imports = file->imports;
+		}
+
+		for (auto& task : loadTasks)
+		{
+			g_tasks.Wait(task);
+		}
+
+		std::vector<FileScope*> found;
+		for (auto load : loads)
+		{
+			if (auto loaded = GetDocument(load); loaded && loaded->fileScope)
+				found.push_back(loaded->fileScope);
+		}
+
+		for (auto import : imports)
+		{
+			if (auto mod = g_modules.Read(import))
+				found.push_back(mod.value()->moduleFile);
+		}
+
+		for (auto dependency : found)
+		{
+			auto index = graph.Add(dependency);
+			auto& edges = graph.dependencies[i];
+			if (index != (int)i && std::find(edges.begin(), edges.end(), index) == edges.end())
+				edges.push_back(index);
+		}
+	}
+
+	graph.FindComponents();
+	graph.FindWaves();
+	return graph;
+}
+
+// tarjan's, with an explicit stack so a long chain of loads can't run out of the real one.
+// a component is finished only after every component it depends on, so they come out dependencies first.
+void DependencyGraph::FindComponents()
+{
+	auto count = (int)files.size();
+	std::vector<int> index(count, -1);
+	std::vector<int> lowLink(count, 0);
+	std::vector<bool> onStack(count, false);
+	std::vector<int> stack;
+	int nextIndex = 0;
+
+	struct Frame
+	{
+		int file;
+		size_t edge;
+	};
+
+	std::vector<Frame> frames;
+
+	for (int start = 0; start < count; start++)
+	{
+		if (index[start] >= 0)
+			continue;
+
+		frames.push_back({ start, 0 });
+		index[start] = lowLink[start] = nextIndex++;
+		stack.push_back(start);
+		onStack[start] = true;
+
+		while (!frames.empty())
+		{
+			auto& frame = frames.back();
+			auto file = frame.file;
+
+			if (frame.edge < dependencies[file].size())
+			{
+				auto next = dependencies[file][frame.edge++];
+				if (index[next] < 0)
+				{
+					index[next] = lowLink[next] = nextIndex++;
+					stack.push_back(next);
+					onStack[next] = true;
+					frames.push_back({ next, 0 }); // frame is dangling from here on
+				}
+				else if (onStack[next])
+				{
+					lowLink[file] = std::min(lowLink[file], index[next]);
+				}
+
+				continue;
+			}
+
+			if (lowLink[file] == index[file])
+			{
+				std::vector<int> component;
+				int member;
+				do
+				{
+					member = stack.back();
+					stack.pop_back();
+					onStack[member] = false;
+					component.push_back(member);
+				} while (member != file);
+
+				components.push_back(std::move(component));
+			}
+
+			frames.pop_back();
+			if (!frames.empty())
+			{
+				auto parent = frames.back().file;
+				lowLink[parent] = std::min(lowLink[parent], lowLink[file]);
+			}
+		}
+	}
+}
+
+// a component's wave is one past the latest wave of anything it depends on.
+void DependencyGraph::FindWaves()
+{
+	std::vector<int> componentOf(files.size());
+	for (int c = 0; c < (int)components.size(); c++)
+	{
+		for (auto file : components[c])
+			componentOf[file] = c;
+	}
+
+	std::vector<int> waveOf(components.size(), 0);
+	for (int c = 0; c < (int)components.size(); c++)
+	{
+		for (auto file : components[c])
+		{
+			for (auto dependency : dependencies[file])
+			{
+				auto other = componentOf[dependency];
+				if (other != c)
+					waveOf[c] = std::max(waveOf[c], waveOf[other] + 1);
+			}
+		}
+
+		if (waveOf[c] >= (int)waves.size())
+			waves.resize(waveOf[c] + 1);
+
+		waves[waveOf[c]].push_back(c);
+	}
+}
+
+void DependencyGraph::Check()
+{
+	for (auto& wave : waves)
+	{
+		std::vector<TaskHandle> tasks;
+		for (auto c : wave)
+		{
+			std::vector<FileScope*> members;
+			for (auto file : components[c])
+				members.push_back(files[file]);
+
+			tasks.push_back(g_tasks.Submit([members = std::move(members)]() mutable
+			{
+				// a file in a cycle can check scopes of the others while it's checked itself, so the whole component is
+				// locked at once. locks always go in address order, another graph sharing some of these files can't deadlock with us.
+				std::sort(members.begin(), members.end());
+				std::vector<std::unique_lock<std::mutex>> locks;
+				for (auto member : members)
+					locks.emplace_back(member->checkMutex);
+
+				std::vector<FileScope*> checking;
+				for (auto member : members)
+				{
+					if (member->status != FileScope::Status::scopesBuilt)
+						continue;
+
+					member->DoTypeCheckingAndInference(member->currentTree);
+					checking.push_back(member);
+				}
+
+				// queries into these from other files go through what's published, not the live scopes.
+				for (auto member : checking)
+				{
+					auto scopesBuilt = FileScope::Status::scopesBuilt;
+					if (member->status.compare_exchange_strong(scopesBuilt, FileScope::Status::checked))
+						member->PublishChecked();
+				}
+			}));
+		}
+
+		for (auto& task : tasks)
+		{
+			g_tasks.Wait(task);
+		}
+	}
+}
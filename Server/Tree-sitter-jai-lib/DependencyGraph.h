@@ -0,0 +1,32 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+
+struct FileScope;
+
+
+// the files a file depends on through #load and #import, and everything those depend on.
+// files that depend on each other in a cycle (a module loading a file that imports the module) are one strongly
+// connected component, and get checked together on one thread, one after the other.
+// the components are put in waves, a wave only depends on the waves before it, so a wave can be checked on all cores at once.
+struct DependencyGraph
+{
+	std::vector<FileScope*> files;
+	std::vector<std::vector<int>> dependencies; // file -> the files it depends on
+	std::unordered_map<FileScope*, int> fileToIndex;
+
+	std::vector<std::vector<int>> components; // component -> its files, dependencies come before dependents
+	std::vector<std::vector<int>> waves; // wave -> its components
+
+	// walks the loads and imports from root, waiting for each file's loads to be built on the way.
+	static DependencyGraph Collect(FileScope* root);
+
+	// type checks every file that isn't yet, wave by wave. the components of a wave run on g_tasks.
+	void Check();
+
+private:
+	int Add(FileScope* file);
+	void FindComponents();
+	void FindWaves();
+};
@@ -0,0 +1,128 @@
+#include "Document.h"
+#include "FileScope.h"
+
+
+ConcurrentDictionary<DocumentSlot*> g_documents;
+
+static std::mutex s_slotMutex;
+static std::mutex s_fileIndexMutex;
+
+static DocumentSlot* GetOrCreateSlot(Hash hash)
+{
+	if (auto slot = g_documents.Read(hash))
+		return slot.value();
+
+	// two threads may be creating the same document, only one slot can win.
+	std::lock_guard lock(s_slotMutex);
+	if (auto slot = g_documents.Read(hash))
+		return slot.value();
+
+	auto slot = new DocumentSlot();
+	g_documents.Write(hash, slot);
+	return slot;
+}
+
+DocumentRecord GetDocument(Hash hash)
+{
+	if (auto slot = g_documents.Read(hash))
+		return slot.value()->current.load(std::memory_order_acquire);
+
+	return nullptr;
+}
+
+DocumentRecord UpdateDocument(Hash hash, const std::function<void(Document&)>& update)
+{
+	auto slot = GetOrCreateSlot(hash);
+	std::lock_guard lock(slot->updateMutex);
+
+	auto document = std::make_shared<Document>();
+	if (auto current = slot->current.load(std::memory_order_acquire))
+		*document = *current;
+
+	document->hash = hash;
+	update(*document);
+
+	DocumentRecord record = document;
+	slot->current.store(record, std::memory_order_release);
+	return record;
+}
+
+static thread_local SnapshotPin* t_pin = nullptr;
+
+SnapshotPin::SnapshotPin(const Snapshot* snapshot)
+{
+	previous = t_pin;
+	analysis = snapshot->analysis.get();
+	published = true;
+	t_pin = this;
+}
+
+SnapshotPin::SnapshotPin(FileScope* analysis)
+{
+	previous = t_pin;
+	this->analysis = analysis;
+	published = false;
+	t_pin = this;
+}
+
+SnapshotPin::~SnapshotPin()
+{
+	t_pin = previous;
+}
+
+FileScope* SnapshotPin::Resolve(uint32_t fileIndex)
+{
+	if (analysis->fileIndex == fileIndex)
+		return analysis;
+
+	auto live = g_fileScopeByIndex.Read(fileIndex);
+	if (!published)
+		return live;
+
+	if (auto it = dependencies.find(fileIndex); it != dependencies.end())
+		return it->second->analysis.get();
+
+	// a file this snapshot has handles into was checked before it, and every checked file publishes. a file that has
+	// nothing out yet was never checked, its live scopes are all there is to read.
+	auto document = GetDocument(live->documentHash);
+	if (!document || !document->snapshot)
+		return live;
+
+	dependencies.emplace(fileIndex, document->snapshot);
+	return document->snapshot->analysis.get();
+}
+
+FileScope* GetFileScope(uint32_t fileIndex)
+{
+	if (t_pin)
+		return t_pin->Resolve(fileIndex);
+
+	return g_fileScopeByIndex.Read(fileIndex);
+}
+
+FileScope* GetOrCreateFileScope(Hash hash, const std::string& path)
+{
+	if (auto document = GetDocument(hash); document && document->fileScope && (path.empty() || !document->path.empty()))
+		return document->fileScope;
+
+	// created under the slot's lock, two threads asking for the same document have to end up with the same file.
+	auto record = UpdateDocument(hash, [&](Document& document)
+	{
+		if (document.path.empty())
+			document.path = path;
+
+		if (document.fileScope)
+			return;
+
+		// and two different documents can't be given the same index.
+		std::lock_guard indexLock(s_fileIndexMutex);
+		auto fileScope = new FileScope();
+		fileScope->documentHash = hash;
+		assert(g_fileScopeByIndex.size() < TypeHandle::none);
+		fileScope->fileIndex = (uint32_t)g_fileScopeByIndex.size();
+		g_fileScopeByIndex.Append(fileScope);
+		document.fileScope = fileScope;
+	});
+
+	return record->fileScope;
+}
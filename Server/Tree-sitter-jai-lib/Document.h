@@ -0,0 +1,91 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <unordered_map>
+#include <stdint.h>
+#include <tree_sitter/api.h>
+
+#include "Hash.h"
+#include "Concurrent.h"
+
+class GapBuffer;
+struct FileScope;
+
+
+// one version of a document that never changes: the tree, the text it was parsed from and the scopes found in it.
+// queries read these instead of the live document, so an edit or a rebuild can't pull anything out from under them.
+// a reader holds on to one for as long as it needs to, the last one to let go frees it.
+struct Snapshot
+{
+	uint64_t generation = 0;
+	std::shared_ptr<TSTree> tree;
+	std::shared_ptr<const GapBuffer> text;
+	std::shared_ptr<FileScope> analysis;
+};
+
+using SnapshotRecord = std::shared_ptr<const Snapshot>;
+
+// handles carry a file index, which leads to the live file. while a pin is alive, the pinned snapshot's index
+// leads to its analysis instead on this thread, so a query that follows a handle stays inside its snapshot.
+// the other files a query with a snapshot pinned gets to lead to their published snapshots, the first one it sees of each
+// is the one it sees for as long as it's pinned, and the pin keeps those alive until then.
+struct SnapshotPin
+{
+	SnapshotPin* previous;
+	FileScope* analysis;
+	bool published; // other files lead to their snapshots, not just this one
+	std::unordered_map<uint32_t, SnapshotRecord> dependencies;
+
+	SnapshotPin(const Snapshot* snapshot);
+	explicit SnapshotPin(FileScope* analysis); // an analysis that isn't published anywhere, like a scratch build
+	~SnapshotPin();
+	SnapshotPin(const SnapshotPin&) = delete;
+	SnapshotPin& operator=(const SnapshotPin&) = delete;
+
+	FileScope* Resolve(uint32_t fileIndex);
+};
+
+// use this over g_fileScopeByIndex when resolving a handle, and over a document's fileScope for a file found through a load or an import.
+FileScope* GetFileScope(uint32_t fileIndex);
+
+
+// everything that belongs to one document, an open file or a loaded module file.
+// the fields of a record are never assigned once it's published. an update copies the latest record, changes the copy
+// and publishes that, so one lookup gets a tree, buffer and scope that went together, even while the document is being updated.
+// tree and buffer are not frozen though: they're the live versions, edited in place and replaced by the next parse.
+// only code holding the file's parse mutex may touch them, everything else reads text or the snapshot.
+struct Document
+{
+	Hash hash;
+	std::string path;
+	TSTree* tree = nullptr; // edited in place and deleted by the next parse, under the parse mutex
+	GapBuffer* buffer = nullptr; // edited in place, under the parse mutex
+	std::shared_ptr<const GapBuffer> text; // a frozen copy of buffer from when tree was parsed, it shares the chunks that haven't been edited since
+	FileScope* fileScope = nullptr;
+	uint64_t generation = 0; // the journal generation the tree was parsed at
+	SnapshotRecord snapshot; // the latest analyzed version
+};
+
+using DocumentRecord = std::shared_ptr<const Document>;
+
+// one per hash, never freed. holds the latest record for the hash.
+struct DocumentSlot
+{
+	std::atomic<DocumentRecord> current;
+	std::mutex updateMutex; // updates copy the record they change, so they go one at a time
+};
+
+extern ConcurrentDictionary<DocumentSlot*> g_documents;
+
+// the latest record for a document, null if nothing was published for it yet.
+DocumentRecord GetDocument(Hash hash);
+
+// hands update a copy of the latest record (or a blank one), then publishes it. returns the published record.
+DocumentRecord UpdateDocument(Hash hash, const std::function<void(Document&)>& update);
+
+// the document's file, made and given the next file index if it doesn't have one yet. path is filled in if it's missing.
+FileScope* GetOrCreateFileScope(Hash hash, const std::string& path = "");
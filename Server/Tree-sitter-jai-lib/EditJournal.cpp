@@ -0,0 +1,55 @@
+#include "EditJournal.h"
+
+
+uint64_t EditJournal::Append(const TSInputEdit& edit)
+{
+	std::lock_guard lock(mutex);
+	edits.push_back(edit);
+	return ++generation;
+}
+
+uint64_t EditJournal::Generation()
+{
+	std::lock_guard lock(mutex);
+	return generation;
+}
+
+bool EditJournal::EditsSince(uint64_t since, uint64_t upTo, std::vector<TSInputEdit>& outEdits)
+{
+	std::lock_guard lock(mutex);
+	if (upTo > generation)
+		upTo = generation;
+
+	if (since >= upTo)
+		return true;
+
+	if (since + 1 < firstGeneration)
+		return false;
+
+	auto first = edits.begin() + (since + 1 - firstGeneration);
+	auto last = edits.begin() + (upTo + 1 - firstGeneration);
+	outEdits.insert(outEdits.end(), first, last);
+	return true;
+}
+
+void EditJournal::Trim(uint64_t upTo)
+{
+	std::lock_guard lock(mutex);
+	if (upTo < firstGeneration)
+		return;
+
+	if (upTo > generation)
+		upTo = generation;
+
+	edits.erase(edits.begin(), edits.begin() + (upTo + 1 - firstGeneration));
+	firstGeneration = upTo + 1;
+}
+
+uint64_t EditJournal::Reset()
+{
+	std::lock_guard lock(mutex);
+	edits.clear();
+	generation++;
+	firstGeneration = generation + 1;
+	return generation;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <stdint.h>
+#include <tree_sitter/api.h>
+
+
+// the edits applied to one document, each one stamped with a generation number.
+// generation 0 is the text the document was created with, every edit bumps it by one.
+// consumers remember the generation they last looked at and ask for everything after it.
+struct EditJournal
+{
+	std::mutex mutex;
+	std::vector<TSInputEdit> edits;
+	uint64_t firstGeneration = 1; // the generation of edits[0]
+	uint64_t generation = 0;
+
+	uint64_t Append(const TSInputEdit& edit);
+	uint64_t Generation();
+
+	// copies the edits made after since, up to and including upTo, into outEdits, oldest first.
+	// upTo is the generation a parse started from, edits made after it aren't in that parse's tree.
+	// returns false if some of them were already trimmed, the caller has to start over from the full text then.
+	bool EditsSince(uint64_t since, uint64_t upTo, std::vector<TSInputEdit>& outEdits);
+
+	// forgets the edits up to and including the given generation, once nobody needs them anymore.
+	void Trim(uint64_t upTo);
+
+	// the document was replaced wholesale, there's nothing to replay from before this.
+	uint64_t Reset();
+};
@@ -1,5 +1,9 @@
 #include "FileScope.h"
+#include "DependencyGraph.h"
+#include "ParserPool.h"
 #include <cassert>
+#include <algorithm>
+#include <bit>
 #include <filesystem>
 
 TypeHandle FileScope::intType;
@@ -10,7 +14,15 @@ TypeHandle FileScope::emptyType;
 Scope* FileScope::builtInScope;
 Hash FileScope::preloadHash;
 
+// bumped whenever a query runs into a declaration that's still being worked out further up the stack.
+static thread_local uint64_t t_cyclesFound = 0;
+
 bool HandleLoad(Hash documentHash);
+
+static TaskHandle LoadInBackground(Hash documentHash)
+{
+	return g_tasks.Submit([documentHash] { HandleLoad(documentHash); });
+}
 Module* RegisterModule(std::string moduleName, std::filesystem::path path);
 std::optional<std::filesystem::path> FindModuleFilePath(std::string name);
 std::optional<TypeHandle> EvaluateMemberAccessType(TSNode node, FileScope* fileScope, Scope* scope);
@@ -35,6 +47,7 @@ std::optional<ScopeDeclaration> FileScope::TryGet(Hash identifierHash)
 	{
 		if (decl.value().flags & DeclarationFlags::Exported)
 		{
+			decl->startByte = DeclarationStart(GetScope(file), *decl);
 			return decl;
 		}
 
@@ -50,6 +63,7 @@ std::optional<ScopeDeclaration> FileScope::SearchExports(Hash identifierHash)
 	{
 		if (decl.value().flags & DeclarationFlags::Exported)
 		{
+			decl->startByte = DeclarationStart(GetScope(file), *decl);
 			return decl;
 		}
 
@@ -57,9 +71,9 @@ std::optional<ScopeDeclaration> FileScope::SearchExports(Hash identifierHash)
 
 	for (auto loadHash : loads)
 	{
-		if (auto file = g_fileScopes.Read(loadHash))
+		if (auto file = GetDocument(loadHash); file && file->fileScope)
 		{
-			if (auto decl = file.value()->SearchExports(identifierHash))
+			if (auto decl = GetFileScope(file->fileScope->fileIndex)->SearchExports(identifierHash))
 			{
 				return decl;
 			}
@@ -75,8 +89,7 @@ int FileScope::SearchAndGetExport(Hash identifierHash, FileScope** outFile, Scop
 	auto declIndex = declScope->GetIndex(identifierHash);
 	if (declIndex >= 0)
 	{
-		auto data = declScope->declarations.Data();
-		auto decl = &data[declIndex].value;
+		auto decl = declScope->GetDeclFromIndex(declIndex);
 		if (decl->flags & DeclarationFlags::Exported)
 		{
 			*outDeclScope = declScope;
@@ -88,9 +101,9 @@ int FileScope::SearchAndGetExport(Hash identifierHash, FileScope** outFile, Scop
 
 	for (auto loadHash : loads)
 	{
-		if (auto file = g_fileScopes.Read(loadHash))
+		if (auto file = GetDocument(loadHash); file && file->fileScope)
 		{
-			auto declIndex = file.value()->SearchAndGetExport(identifierHash, outFile, outDeclScope);
+			auto declIndex = GetFileScope(file->fileScope->fileIndex)->SearchAndGetExport(identifierHash, outFile, outDeclScope);
 			if (declIndex >= 0)
 			{
 				return declIndex;
@@ -116,9 +129,9 @@ std::optional<ScopeDeclaration> FileScope::SearchModules(Hash identifierHash)
 
 	for (auto loadHash : loads)
 	{
-		if (auto file = g_fileScopes.Read(loadHash))
+		if (auto file = GetDocument(loadHash); file && file->fileScope)
 		{
-			if (auto decl = file.value()->SearchExports(identifierHash))
+			if (auto decl = GetFileScope(file->fileScope->fileIndex)->SearchExports(identifierHash))
 			{
 				return decl;
 			}
@@ -144,9 +157,9 @@ int FileScope::SearchAndGetModule(Hash identifierHash, FileScope** outFile, Scop
 
 	for (auto loadHash : loads)
 	{
-		if (auto file = g_fileScopes.Read(loadHash))
+		if (auto file = GetDocument(loadHash); file && file->fileScope)
 		{
-			auto declIndex = file.value()->SearchAndGetExport(identifierHash, outFile, declScope);
+			auto declIndex = GetFileScope(file->fileScope->fileIndex)->SearchAndGetExport(identifierHash, outFile, declScope);
 			if (declIndex >= 0)
 			{
 				return declIndex;
@@ -161,6 +174,7 @@ std::optional<ScopeDeclaration> FileScope::Search(Hash identifierHash)
 {
 	if (auto decl = GetScope(file)->TryGet(identifierHash))
 	{
+		decl->startByte = DeclarationStart(GetScope(file), *decl);
 		return decl;
 	}
 
@@ -169,7 +183,7 @@ std::optional<ScopeDeclaration> FileScope::Search(Hash identifierHash)
 
 static const TypeKing* GetGlobalType(TypeHandle handle)
 {
-	return g_fileScopeByIndex.Read(handle.fileIndex)->GetType(handle);
+	return GetFileScope(handle.fileIndex)->GetType(handle);
 }
 
 
@@ -233,23 +247,7 @@ void FileScope::HandleNamespaceImport(TSNode node, Cursor& cursor, TypeHandle& h
 	auto endOffset = ts_node_end_byte(nameNode) - 1;
 	buffer_view view = buffer_view(startOffset, endOffset, buffer);
 	auto moduleNameHash = StringHash(view);
-
-	// copy and pasted from handle import node
-	if (auto mod = g_modules.Read(moduleNameHash))
-	{
-		if (mod.value()->moduleFile->status == Status::dirty)
-			loadFutures.push_back(std::async(std::launch::async, HandleLoad, mod.value()->moduleFileHash));
-	}
-	else
-	{
-		auto moduleName = view.Copy();
-		if (auto modulePath = FindModuleFilePath(moduleName))
-		{
-			// then we need to create the module.
-			auto mod = RegisterModule(moduleName, *modulePath);
-			loadFutures.push_back(std::async(std::launch::async, HandleLoad, mod->moduleFileHash));
-		}
-	}
+	LoadModule(moduleNameHash, view);
 
 	if (auto modopt = g_modules.Read(moduleNameHash))
 	{
@@ -393,10 +391,10 @@ void FileScope::HandleNamedDecl(const TSNode nameNode, ScopeHandle currentScope,
 				else
 				{
 					handle = AllocateType();
-					auto king = &types[handle.index];
-					king->name = GetIdentifierFromBufferCopy(identifiers[0], buffer); //@todo this is probably not ideal, allocating a string for every type name every time.
+					auto king = MutableType(handle);
+					king->name = GetInternedIdentifier(identifiers[0], buffer);
 					handle.scope = AllocateScope(declarationNode, currentScope, false);
-					GetScope(handle.scope)->associatedType = handle;
+					MutableScope(handle.scope)->associatedType = handle;
 				}
 
 				cursor.Sibling(); // skip "}"
@@ -442,8 +440,8 @@ void FileScope::HandleUsingStatement(TSNode node, ScopeHandle scope, std::vector
 
 void FileScope::HandleForLoop(TSNode scopeNode, ScopeHandle scopeHandle, Cursor& cursor)
 {
-	static auto itHash = StringHash("it");
-	static auto it_indexHash = StringHash("it_index");
+	static auto itHash = IdentifierHash("it");
+	static auto it_indexHash = IdentifierHash("it_index");
 
 	// so first find out if we have declared any iterators, and if not then add 
 	cursor.Child(); // for token
@@ -601,9 +599,20 @@ void FileScope::FindDeclarations(TSNode scopeNode, ScopeHandle scope,  bool& exp
 	bool enumDecl = false;
 	auto scopeSymbol = ts_node_symbol(scopeNode);
 
+	// if/else/while share the scope they are in, only the node the scope belongs to records the exporting state around it.
+	bool ownsScope = scopeSymbol != g_constants.ifStatement && scopeSymbol != g_constants.elseStatement && scopeSymbol != g_constants.whileLoop;
+	if (ownsScope)
+		MutableScope(scope)->exportingIn = exporting;
+
 	if (scopeSymbol == g_constants.funcDefinition)
 	{
 		HandleFunctionDefnitionParameters(scopeNode, scope, cursor);
+
+		if (lazy)
+		{
+			MutableScope(scope)->exportingOut = exporting;
+			return;
+		}
 	}
 	else if (scopeSymbol == g_constants.enumDecl)
 	{
@@ -665,7 +674,7 @@ void FileScope::FindDeclarations(TSNode scopeNode, ScopeHandle scope,  bool& exp
 		}
 		else if (type == g_constants.ifStatement || type == g_constants.elseStatement || type == g_constants.whileLoop)
 		{
-			_nodeToScopes.insert(std::make_pair(node.id, scope));
+			_nodeToScopes->insert(std::make_pair(node.id, scope));
 			structs.push_back(node);
 		}
 		else if (type == g_constants.import)
@@ -690,6 +699,8 @@ void FileScope::FindDeclarations(TSNode scopeNode, ScopeHandle scope,  bool& exp
 		FindDeclarations(structNode, scopeHandle, exporting);
 	}
 
+	if (ownsScope)
+		MutableScope(scope)->exportingOut = exporting;
 
 }
 
@@ -717,8 +728,8 @@ void FileScope::HandleFunctionDefnitionParameters(TSNode node, ScopeHandle curre
 	// we want to extract the parameters from the function header.
 	auto headerNode = cursor.Current();
 	auto typeHandle = GetScope(currentScope)->associatedType;
-	auto king = &types[typeHandle.index];
-	king->name = GetIdentifierFromBufferCopy(headerNode, buffer);
+	auto king = MutableType(typeHandle);
+	king->name = StoreName(GetIdentifierFromBufferCopy(headerNode, buffer));
 
 	cursor.Child(); //inside function header, should be parameter list
 
@@ -749,7 +760,7 @@ void FileScope::HandleFunctionDefnitionParameters(TSNode node, ScopeHandle curre
 		auto symbol = ts_node_symbol(parameterNode);
 		if (symbol == g_constants.parameter)
 		{
-			king->parameters.push_back(GetIdentifierFromBufferCopy(parameterNode, buffer));
+			king->parameters.push_back(StoreName(GetIdentifierFromBufferCopy(parameterNode, buffer)));
 
 			//get identifier
 			cursor.Child();
@@ -846,9 +857,9 @@ TypeHandle FileScope::HandleFuncDefinitionNode(TSNode node, ScopeHandle currentS
 	auto scopeNode = cursor.Current();
 
 	auto typeHandle = AllocateType();
-	auto king = &types[typeHandle.index];
+	auto king = MutableType(typeHandle);
 	auto scopeHandle = AllocateScope(node, currentScope, true);
-	GetScope(scopeHandle)->associatedType = typeHandle;
+	MutableScope(scopeHandle)->associatedType = typeHandle;
 	typeHandle.scope = scopeHandle;
 	structs.push_back(node); // not the scope node! this is how we can know we're doing a function definition later.
 
@@ -868,21 +879,34 @@ void FileScope::HandleImportNode(TSNode node)
 	buffer_view view = buffer_view(startOffset, endOffset, buffer);
 	auto moduleNameHash = StringHash(view);
 	imports.push_back(moduleNameHash);
+	LoadModule(moduleNameHash, view);
+}
 
+void FileScope::LoadModule(Hash moduleNameHash, buffer_view moduleNameView)
+{
 	if (auto mod = g_modules.Read(moduleNameHash))
 	{
 		if (mod.value()->moduleFile->status == Status::dirty)
-			loadFutures.push_back(std::async(std::launch::async, HandleLoad, mod.value()->moduleFileHash));
+			loadTasks.push_back(LoadInBackground(mod.value()->moduleFileHash));
 	}
 	else
 	{
-		auto moduleName = view.Copy();
-		if (auto modulePath = FindModuleFilePath(moduleName))
-		{
-			// then we need to create the module.
-			auto mod = RegisterModule(moduleName, *modulePath);
-			loadFutures.push_back(std::async(std::launch::async, HandleLoad, mod->moduleFileHash));
-		}
+		LoadModule(moduleNameHash, moduleNameView.Copy());
+	}
+}
+
+void FileScope::LoadModule(Hash moduleNameHash, const std::string& moduleName)
+{
+	if (auto mod = g_modules.Read(moduleNameHash))
+	{
+		if (mod.value()->moduleFile->status == Status::dirty)
+			loadTasks.push_back(LoadInBackground(mod.value()->moduleFileHash));
+	}
+	else if (auto modulePath = FindModuleFilePath(moduleName))
+	{
+		// then we need to create the module.
+		auto mod = RegisterModule(moduleName, *modulePath);
+		loadTasks.push_back(LoadInBackground(mod->moduleFileHash));
 	}
 }
 
@@ -895,87 +919,277 @@ void FileScope::HandleLoadNode(TSNode node)
 	auto endOffset = ts_node_end_byte(nameNode) - 1;
 	buffer_view view = buffer_view(startOffset, endOffset, buffer);
 	// get the current directory, and append the load name to it.
-	if (auto currentDirectory = g_filePaths.Read(documentHash))
+	if (auto current = GetDocument(documentHash); current && !current->path.empty())
 	{
-		auto path = std::filesystem::path(currentDirectory.value());
+		auto path = std::filesystem::path(current->path);
 		path.replace_filename(view.Copy());
-		auto str = path.string();
-		auto loadNameHash = StringHash(str);
-		if (!g_filePaths.Read(loadNameHash))
-		{
-			g_filePaths.Write(loadNameHash, str);
-		}
-
-		loads.push_back(loadNameHash);
+		LoadFile(path.string());
+	}
 
-		if (auto fileOpt = g_fileScopes.Read(loadNameHash))
-		{
-			auto file = fileOpt.value();
-			if (file->status == Status::dirty)
-				loadFutures.push_back(std::async(std::launch::async, HandleLoad, loadNameHash));
-		}
-		else
-		{
-			loadFutures.push_back(std::async(std::launch::async, HandleLoad, loadNameHash));
-		}
+	// else raise diagnostic that this load was not found
+}
 
+void FileScope::LoadFile(const std::string& path)
+{
+	auto loadNameHash = StringHash(path);
+	auto loaded = GetDocument(loadNameHash);
+	if (!loaded || loaded->path.empty())
+	{
+		loaded = UpdateDocument(loadNameHash, [&](Document& document) { document.path = path; });
 	}
 
-	// else raise diagnostic that this load was not found
+	loads.push_back(loadNameHash);
+
+	if (loaded->fileScope)
+	{
+		auto file = loaded->fileScope;
+		if (file->status == Status::dirty)
+			loadTasks.push_back(LoadInBackground(loadNameHash));
+	}
+	else
+	{
+		loadTasks.push_back(LoadInBackground(loadNameHash));
+	}
 }
 
 void FileScope::CreateTopLevelScope(TSNode node, ScopeStack& stack, bool& exporting)
 {
-	file = AllocateScope(node, { UINT16_MAX }, false);
+	file = AllocateScope(node, { ScopeHandle::none }, false);
 	auto self = AllocateType();
-	auto king = &types[self.index];
+	auto king = MutableType(self);
 	king->name = "namespace";
 
 	loads.push_back(StringHash("builtin"));
 	//if(documentHash != preloadHash)
 		//loads.push_back(preloadHash);
 
+	// a declaration can't say where it starts past maxStartByte. a file that big is left with an empty file scope,
+	// rather than declarations that point somewhere else in it.
+	if (ts_node_end_byte(node) > ScopeDeclaration::maxStartByte)
+		return;
 
 	FindDeclarations(node, file, exporting);
 }
 
 
+InferenceMemo::~InferenceMemo()
+{
+	Free();
+}
+
+void InferenceMemo::Free()
+{
+	for (size_t i = 0; i < columnCount; i++)
+		retired.push_back(columns[i].load(std::memory_order_relaxed));
+
+	for (auto column : retired)
+	{
+		if (column)
+		{
+			delete[] column->slots;
+			delete column;
+		}
+	}
+
+	retired.clear();
+	delete[] columns;
+	columns = nullptr;
+	columnCount = 0;
+}
+
+void InferenceMemo::Reset(size_t scopeCount)
+{
+	Free();
+	columns = new std::atomic<Column*>[scopeCount];
+	columnCount = scopeCount;
+	for (size_t i = 0; i < scopeCount; i++)
+		columns[i].store(nullptr, std::memory_order_relaxed);
+}
+
+InferenceMemo::Slot* InferenceMemo::Get(uint32_t scope, uint32_t index, uint32_t declarationCount)
+{
+	if (scope >= columnCount)
+		return nullptr;
+
+	auto column = columns[scope].load(std::memory_order_acquire);
+	if (column && index < column->count)
+		return &column->slots[index];
+
+	std::lock_guard lock(growMutex);
+	column = columns[scope].load(std::memory_order_acquire);
+	if (column && index < column->count)
+		return &column->slots[index];
+
+	// a snapshot's scopes don't change, so this only makes a column bigger for a live file whose scope a using added to.
+	// whatever was being worked out in the old one starts over.
+	auto grown = new Column{ std::max(declarationCount, index + 1), nullptr };
+	grown->slots = new Slot[grown->count];
+	if (column)
+	{
+		for (uint32_t i = 0; i < column->count; i++)
+		{
+			auto state = column->slots[i].state.load(std::memory_order_acquire);
+			grown->slots[i].type = column->slots[i].type;
+			grown->slots[i].state.store(state == evaluating ? unknown : state, std::memory_order_relaxed);
+		}
+
+		retired.push_back(column);
+	}
+
+	columns[scope].store(grown, std::memory_order_release);
+	return &grown->slots[index];
+}
+
+size_t InferenceMemo::CountEvaluated() const
+{
+	size_t count = 0;
+	for (size_t i = 0; i < columnCount; i++)
+	{
+		auto column = columns[i].load(std::memory_order_acquire);
+		for (uint32_t j = 0; column && j < column->count; j++)
+			count += column->slots[j].state.load(std::memory_order_relaxed) == evaluated;
+	}
+
+	return count;
+}
+
+
+// the declarations this thread is working out the types of, innermost last.
+struct Evaluating
+{
+	const FileScope* file;
+	const Scope* scope;
+	int index;
+};
+
+static thread_local std::vector<Evaluating> t_evaluating;
+
+// the type of a declaration, worked out the first time something asks for it and kept in the file's memo from then on.
+// a declaration asked for again while this thread is working it out is in a cycle (a :: b; b :: a;), that ask fails instead of recursing forever.
+// one another thread is working out gets worked out here too without being kept, rather than waiting on a thread that could be waiting on this one.
+// a snapshot never changes, so a declaration that can't be worked out there is kept as having no type.
+// a live file's neighbours might still get what it's missing, and a failure that came from a cycle could go
+// the other way when asked from the other end, those aren't kept.
+std::optional<TypeHandle> FileScope::InferDeclarationType(Scope* scope, int index)
+{
+	auto decl = scope->GetDeclFromIndex(index);
+	if (decl->HasFlags(DeclarationFlags::Evaluated))
+		return decl->type;
+
+	// restored from the index cache, there's no tree to find the rhs in.
+	if (!currentTree)
+		return std::nullopt;
+
+	for (auto& evaluating : t_evaluating)
+	{
+		if (evaluating.file == this && evaluating.scope == scope && evaluating.index == index)
+		{
+			t_cyclesFound++;
+			return std::nullopt;
+		}
+	}
+
+	auto slot = memo.Get(ScopeIndexOf(scope), index, (uint32_t)scope->declarations.Size());
+	bool claimed = false;
+	if (slot)
+	{
+		auto state = slot->state.load(std::memory_order_acquire);
+		while (state == InferenceMemo::unknown && !claimed)
+			claimed = slot->state.compare_exchange_weak(state, InferenceMemo::evaluating, std::memory_order_acquire);
+
+		if (state == InferenceMemo::evaluated)
+			return slot->type;
+
+		if (state == InferenceMemo::unresolved)
+			return std::nullopt;
+	}
+
+	t_evaluating.push_back({ this, scope, index });
+	auto cyclesBefore = t_cyclesFound;
+
+	// the rhs is where the declaration is now, its scope may not have taken in the latest moves.
+	auto moved = *decl;
+	moved.startByte = DeclarationStart(scope, moved);
+	auto node = ConstructRhsFromDecl(moved, currentTree);
+	auto type = EvaluateNodeExpressionType(node, scope);
+	t_evaluating.pop_back();
+
+	// a using checked on the way can add to the scope and move its declarations.
+	decl = scope->GetDeclFromIndex(index);
+
+	// an iterator is declared as what it iterates over, it's one of the things in there.
+	if (type && decl->HasFlags(DeclarationFlags::Iterator))
+		type->Dereference();
+
+	if (claimed)
+	{
+		if (type)
+		{
+			slot->type = *type;
+			slot->state.store(InferenceMemo::evaluated, std::memory_order_release);
+		}
+		else if (published && t_cyclesFound == cyclesBefore)
+		{
+			slot->state.store(InferenceMemo::unresolved, std::memory_order_release);
+		}
+		else
+		{
+			slot->state.store(InferenceMemo::unknown, std::memory_order_release);
+		}
+	}
+
+	return type;
+}
+
+// does what the rest of the analysis needs done to a scope before anything is looked up in it: injects the members of
+// its usings, and hands the types of its returns to its function. the types of the other declarations are left to whoever asks for them.
 void FileScope::CheckScope(Scope* scope)
 {
+	// a using of something that uses this scope back gets here again while it's still going, it sees what's been injected so far.
+	// a snapshot was checked before it was made, and nothing but its memo is written to.
+	if (scope->checked || scope->checking || published)
+		return;
+
+	scope->checking = true;
+
 	auto size = scope->declarations.Size();
+	auto structuralFlags = (DeclarationFlags)(DeclarationFlags::Using | DeclarationFlags::Return);
+	uint32_t candidates = 0;
 
 	for (int i = 0; i < size; i++)
 	{
-		auto decl = scope->GetDeclFromIndex(i);
-
-		if (!decl->HasFlags(DeclarationFlags::Evaluated))
+		// most declarations need nothing here, the flags column picks out the rest 16 at a time.
+		// anything past the end when the group was matched is a candidate, usings add to the end as this goes.
+		if ((i & 15) == 0)
 		{
-			auto node = ConstructRhsFromDecl(*decl, currentTree);
-
-			if (auto typeHandle = EvaluateNodeExpressionType(node, scope))
-			{
-				decl->type = *typeHandle;
-				decl->flags = decl->flags | DeclarationFlags::Evaluated;
-			}
+			candidates = ~scope->declarations.MatchFlags(i, structuralFlags, DeclarationFlags::None);
 		}
 
+		if (((candidates >> (i & 15)) & 1) == 0)
+			continue;
+
+		auto type = InferDeclarationType(scope, i);
+		if (!type)
+			continue;
+
+		auto decl = scope->GetDeclFromIndex(i);
+
 		// if this has usings, we need to inject them.
-		if (decl->HasFlags(DeclarationFlags::Evaluated | DeclarationFlags::Using))
+		if (decl->HasFlags(DeclarationFlags::Using))
 		{
 			// add members of type to scope.
-			auto typeHandle = decl->type;
-			auto memberFile = g_fileScopeByIndex.Read(typeHandle.fileIndex);
+			auto typeHandle = *type;
+			auto memberFile = GetFileScope(typeHandle.fileIndex);
 			auto memberScope = memberFile->GetScope(typeHandle.scope);
+			memberFile->CheckScope(memberScope);
 
-			// we probably need to make sure we don't have any circular dependencies in here.
-			if (!memberScope->checked)
-				memberFile->CheckScope(memberScope);
-
-			memberScope->InjectMembersTo(scope, decl->startByte);
+			// members from another file keep that file's offsets, an incremental rebuild must not shift them.
+			auto injectedFlags = memberFile == this ? DeclarationFlags::None : DeclarationFlags::ForeignOffset;
+			memberScope->InjectMembersTo(scope, memberFile->shiftLog, injectedFlags);
 			size += memberScope->declarations.Size();
 
 			decl = scope->GetDeclFromIndex(i);
-			decl->flags = (DeclarationFlags)(decl->flags & (~DeclarationFlags::Using));
+			scope->SetDeclarationFlags(i, (DeclarationFlags)(decl->flags & (~DeclarationFlags::Using)));
 			if (decl->HasFlags(DeclarationFlags::Expression))
 			{
 				decl->SetLength(0); // this is a hack so that this 'using' declaration doesn't show up in completions.
@@ -983,28 +1197,19 @@ void FileScope::CheckScope(Scope* scope)
 			}
 		}
 
-			
-		
-		if (decl->HasFlags(DeclarationFlags::Return | DeclarationFlags::Evaluated))
+		if (decl->HasFlags(DeclarationFlags::Return))
 		{
-			auto king = GetType(scope->associatedType);
-			king->returnTypes.push_back(decl->type);
+			auto king = MutableType(scope->associatedType);
+			king->returnTypes.push_back(*type);
 
 			if (decl->HasFlags(DeclarationFlags::Expression))
 			{
 				decl->SetLength(0);
 			}
 		}
-		
-		if (decl->HasFlags(DeclarationFlags::Iterator | DeclarationFlags::Evaluated)) 
-		{
-			// if this is an iterator, then we want to dereference the type.
-			bool valid = decl->type.Dereference();
-			//assert(valid);
-		}
-
 	}
 
+	scope->checking = false;
 	scope->checked = true;
 }
 
@@ -1012,40 +1217,57 @@ void FileScope::CheckScope(Scope* scope)
 void FileScope::DoTypeCheckingAndInference(TSTree* tree)
 {
 	// so i think that we should be able to do this in order of scopes.
-	for (auto& scope : scopeKings)
+	// the scopes that aren't checked were all made since the last publish, so they're on pages of this file's own.
+	for (uint32_t i = 0; i < scopeKings.size(); i++)
 	{
-		if(!scope.checked)
-			CheckScope(&scope);
+		if(!scopeKings[i].checked)
+			CheckScope(&scopeKings[i]);
 	}
 }
 
 void FileScope::WaitForDependencies()
 {
-	// this will deadlock if modules import themselves, which i *think* is allowed.
-	// an alternative is to wait for the individual condition variables of each load
-	// but that presents a possibility where we get to this point and the condition variables havent been created yet!
-	for (auto& future : loadFutures)
+	// only waits for the files this one started loading to be built, the loads run in the pool and waiting on one runs
+	// whatever this thread queued up itself in the meantime. a module importing itself doesn't start a load, it's already building.
+	for (auto& task : loadTasks)
 	{
-		future.wait();
+		g_tasks.Wait(task);
 	}
 }
 
 
-void FileScope::Build()
+// checks the files this one depends on before it, the ones that don't depend on each other in parallel.
+// this file is the last wave, it depends on everything else in the graph.
+void FileScope::CheckWithDependencies()
 {
+	auto graph = DependencyGraph::Collect(this);
+	graph.Check();
+}
+
+
+// builds the scopes from a tree nothing else edits, the file takes it over. treeText is the text it was parsed from.
+// the parse mutex isn't held for this, so edits to the document don't wait on a build.
+void FileScope::Build(TSTree* tree, std::shared_ptr<const GapBuffer> treeText)
+{
+
+	// a dependency wave could be type checking the scopes that are about to go. the lock is taken before the status
+	// changes, so whoever sees a file building can wait for the build by taking its lock.
+	std::lock_guard checkLock(checkMutex);
 
 	auto dirtyStatus = Status::dirty;
 	if (!status.compare_exchange_strong(dirtyStatus, Status::buliding))
 	{
+		ts_tree_delete(tree);
 		return;
 	}
 
 	Clear();
 
-	buffer = g_buffers.Read(documentHash).value();
-	auto tree = g_trees.Read(documentHash).value();
+	text = std::move(treeText);
+	buffer = text.get();
 	auto root = ts_tree_root_node(tree);
 
+	builtTree = std::shared_ptr<TSTree>(tree, ts_tree_delete);
 	currentTree = tree;
 
 	ScopeStack stack;
@@ -1055,9 +1277,35 @@ void FileScope::Build()
 
 	CreateTopLevelScope(root, stack, exporting);
 
+	memo.Reset(scopeKings.size());
 	status = Status::scopesBuilt;
 }
 
+// builds from whatever the document has now.
+void FileScope::Build()
+{
+	TSTree* tree;
+	std::shared_ptr<const GapBuffer> treeText;
+	{
+		std::lock_guard lock(parseMutex);
+		auto document = GetDocument(documentHash);
+		tree = ts_tree_copy(document->tree);
+		treeText = document->text;
+	}
+
+	Build(tree, std::move(treeText));
+}
+
+// a parse that ran out of time and won't be resumed goes back to the pool. the caller holds the parse mutex.
+void FileScope::DropPendingParse()
+{
+	if (!pendingParser)
+		return;
+
+	ParserPool::Release(pendingParser);
+	pendingParser = nullptr;
+}
+
 
 
 const std::optional<TypeHandle> FileScope::GetTypeFromSymbol(TSNode node, Scope* scope, TSSymbol symbol)
@@ -1121,28 +1369,16 @@ const std::optional<TypeHandle> FileScope::GetTypeFromSymbol(TSNode node, Scope*
 			}
 			*/
 
-			auto decl = declScope->GetDeclFromIndex(declIndex);
-			if (!decl->HasFlags(DeclarationFlags::Evaluated))
-			{
-				auto node = ConstructRhsFromDecl(*decl, currentTree);
-
-				if (auto typeHandle = EvaluateNodeExpressionType(node, scope))
-				{
-					decl->type = *typeHandle;
-					decl->flags = decl->flags | DeclarationFlags::Evaluated;
-				}
-				else
-				{
-					return std::nullopt;
-				}
-			}
+			auto functionType = declFile->InferDeclarationType(declScope, declIndex);
+			if (!functionType)
+				return std::nullopt;
 
 			// and check the scope of the function's type, to infer returns
-			auto funcScope = declFile->GetScope(decl->type.scope);
+			auto funcScope = declFile->GetScope(functionType->scope);
 			if (!funcScope->checked)
 				declFile->CheckScope(funcScope);
 
-			auto king = GetType(decl->type);
+			auto king = GetType(*functionType);
 			if(king->returnTypes.size() > 0)
 				return king->returnTypes[0];
 		}
@@ -1158,7 +1394,7 @@ const std::optional<TypeHandle> FileScope::GetTypeFromSymbol(TSNode node, Scope*
 const std::optional<TypeHandle> FileScope::EvaluateNodeExpressionType(TSNode node, Scope* startScope)
 {
 	auto symbol = ts_node_symbol(node);
-	auto hash = GetIdentifierHash(node, buffer);
+	auto hash = FindIdentifierHash(node, buffer);
 	auto scope = startScope;
 
 	if (symbol == g_constants.identifier)
@@ -1175,7 +1411,7 @@ const std::optional<TypeHandle> FileScope::EvaluateNodeExpressionType(TSNode nod
 				auto decl = scope->GetDeclFromIndex(declIndex);
 				auto startByte = ts_node_start_byte(node);
 
-				auto notInImperativeOrder = !decl->HasFlags(DeclarationFlags::Constant) && scope->imperative && (decl->startByte > startByte);
+				auto notInImperativeOrder = !decl->HasFlags(DeclarationFlags::Constant) && scope->imperative && (DeclarationStart(scope, *decl) > startByte);
 				auto expressionType = decl->HasFlags(DeclarationFlags::Expression); // this will be declaring the name of the thing in the same scope we're looking for the RHS, and that will cause an infinite loop.
 				if (notInImperativeOrder || expressionType)
 				{
@@ -1189,23 +1425,15 @@ const std::optional<TypeHandle> FileScope::EvaluateNodeExpressionType(TSNode nod
 				}
 				else
 				{
-					auto rhsNode = ConstructRhsFromDecl(*decl, currentTree);
-					if (rhsNode.id == node.id)
-						return std::nullopt;
-
-					if (auto type = EvaluateNodeExpressionType(rhsNode, scope))
+					auto type = InferDeclarationType(scope, declIndex);
+					if (type)
 					{
 						auto memberScope = GetScope(type->scope);
 						if (memberScope != startScope && !memberScope->checked)
 							CheckScope(memberScope);
-
-						decl->type = *type;
-						decl->flags = decl->flags | DeclarationFlags::Evaluated;
-
-						return type;
 					}
 
-					return std::nullopt;
+					return type;
 				}
 			}
 
@@ -1224,32 +1452,15 @@ const std::optional<TypeHandle> FileScope::EvaluateNodeExpressionType(TSNode nod
 			}
 			*/
 
-			auto decl = declScope->GetDeclFromIndex(declIndex);
-			if (decl->flags & DeclarationFlags::Evaluated)
+			auto type = moduleFile->InferDeclarationType(declScope, declIndex);
+			if (type)
 			{
-				auto memberScope = moduleFile->GetScope(decl->type.scope);
+				auto memberScope = moduleFile->GetScope(type->scope);
 				if (memberScope != startScope && !memberScope->checked)
 					moduleFile->CheckScope(memberScope);
-
-				return decl->type;
 			}
-			else
-			{
-				auto node = ConstructRhsFromDecl(*decl, moduleFile->currentTree);
-				if (auto type = moduleFile->EvaluateNodeExpressionType(node, declScope))
-				{
-					decl->type = *type;
-					decl->flags = decl->flags | DeclarationFlags::Evaluated;
-					auto memberScope = moduleFile->GetScope(type->scope);
-					if (memberScope != startScope && !memberScope->checked)
-						moduleFile->CheckScope(memberScope);
 
-					return type;
-				}
-
-
-				return std::nullopt;
-			}
+			return type;
 		}
 	}
 	else
@@ -1262,119 +1473,557 @@ const std::optional<TypeHandle> FileScope::EvaluateNodeExpressionType(TSNode nod
 
 
 
-void FileScope::RebuildScope(TSNode newScopeNode, TSInputEdit* edits, int editCount, TSNode root)
+// moves a byte range through an edit, offsets inside the replaced text end up on its edges.
+static void EditRange(uint32_t& start, uint32_t& end, const TSInputEdit& edit)
 {
-	/*
-	this->edits = edits;
-	this->editCount = editCount;
+	auto move = [&](uint32_t offset, uint32_t inside)
+	{
+		if (offset >= edit.old_end_byte)
+			return offset - edit.old_end_byte + edit.new_end_byte;
+		if (offset > edit.start_byte)
+			return inside;
+		return offset;
+	};
+
+	start = move(start, edit.start_byte);
+	end = move(end, edit.new_end_byte);
+}
+
+// walks the tree the scopes were built from and the new tree side by side, recording which old node became which new node.
+// subtrees tree-sitter reused keep their ids so they get skipped, and we stop at stopAt since everything inside it is thrown away.
+// anything else that changed shape means the edit wasn't as local as it looked.
+static bool MatchNodes(Cursor& oldCursor, Cursor& newCursor, const void* stopAt, std::unordered_map<const void*, TSNode>& newToOld)
+{
+	auto oldNode = oldCursor.Current();
+	auto newNode = newCursor.Current();
+
+	if (oldNode.id == newNode.id)
+		return true;
+
+	if (ts_node_symbol(oldNode) != ts_node_symbol(newNode))
+		return false;
+
+	newToOld[newNode.id] = oldNode;
+
+	if (newNode.id == stopAt)
+		return true;
 
-	// first first find the scope node we are within
-	while (!ts_node_is_null(newScopeNode))
+	bool oldChild = oldCursor.Child();
+	if (oldChild != newCursor.Child())
+		return false;
+
+	if (!oldChild)
+		return true;
+
+	while (true)
 	{
-		auto symbol = ts_node_symbol(newScopeNode);
+		if (!MatchNodes(oldCursor, newCursor, stopAt, newToOld))
+			return false;
 
-		if (symbol == g_constants.dataScope)
-		{
+		bool oldSibling = oldCursor.Sibling();
+		if (oldSibling != newCursor.Sibling())
+			return false;
+
+		if (!oldSibling)
 			break;
+	}
+
+	oldCursor.Parent();
+	newCursor.Parent();
+	return true;
+}
+
+
+// the scope with a table of its own to write to. one made before the last publish is the snapshot's too, it gets copied,
+// and the starts of its declarations take in the moves they haven't yet.
+Scope* FileScope::MutableDeclarations(ScopeHandle handle)
+{
+	auto scope = MutableScope(handle);
+	if (scope->tableEpoch != publishes)
+	{
+		scope->declarations = scope->declarations.Copy(CurrentArena());
+		scope->tableEpoch = publishes;
+	}
+
+	if (scope->shiftsApplied < shiftLog.End())
+	{
+		auto size = scope->declarations.Size();
+		auto data = scope->declarations.Declarations();
+		for (size_t i = 0; i < size; i++)
+			data[i].startByte = scope->DeclarationStart(data[i], shiftLog);
+
+		scope->shiftsApplied = shiftLog.End();
+	}
+
+	return scope;
+}
+
+
+// rebuilds only the function whose body contains every edit since the last build, the scopes nested in it get freed and found again.
+// everything else is kept, it just gets its offsets shifted and its node ids moved over to the new tree.
+// the scopes and types of whatever was nested in it go on the free lists, the rebuild takes them back from there.
+// returns false when the change isn't contained like that (it touches a header, a struct, the file scope...), the caller does a full Build then.
+// oldTree is the edited live tree newTree was parsed from, newTree is a copy nothing else edits. the file takes it over unless this returns false.
+bool FileScope::RebuildScope(TSTree* oldTree, TSTree* newTree, std::shared_ptr<const GapBuffer> newText, TSInputEdit* edits, int editCount)
+{
+	if (!builtTree || editCount == 0)
+		return false;
+
+	// the edits are in order, so each one moves the region changed before it.
+	uint32_t changedStart = UINT32_MAX;
+	uint32_t changedEnd = 0;
+	for (int i = 0; i < editCount; i++)
+	{
+		if (i > 0)
+			EditRange(changedStart, changedEnd, edits[i]);
+
+		changedStart = std::min(changedStart, edits[i].start_byte);
+		changedEnd = std::max(changedEnd, edits[i].new_end_byte);
+	}
+
+	uint32_t rangeCount;
+	auto ranges = ts_tree_get_changed_ranges(oldTree, newTree, &rangeCount);
+	for (uint32_t i = 0; i < rangeCount; i++)
+	{
+		changedStart = std::min(changedStart, ranges[i].start_byte);
+		changedEnd = std::max(changedEnd, ranges[i].end_byte);
+	}
+	free(ranges);
+
+	// function definitions whose braces are outside of the change, innermost first.
+	auto newRoot = ts_tree_root_node(newTree);
+	std::vector<TSNode> candidates;
+	auto node = ts_node_descendant_for_byte_range(newRoot, changedStart, changedEnd);
+	while (!ts_node_is_null(node))
+	{
+		if (ts_node_symbol(node) == g_constants.funcDefinition)
+		{
+			auto body = ts_node_child(node, ts_node_child_count(node) - 1);
+			if (ts_node_start_byte(body) < changedStart && changedEnd < ts_node_end_byte(body))
+				candidates.push_back(node);
 		}
-		else if (symbol == g_constants.imperativeScope)
+
+		node = ts_node_parent(node);
+	}
+
+	if (candidates.empty())
+		return false;
+
+	std::unordered_map<const void*, TSNode> newToOld;
+	Cursor oldCursor;
+	Cursor newCursor;
+	oldCursor.Reset(ts_tree_root_node(builtTree.get()));
+	newCursor.Reset(newRoot);
+	if (!MatchNodes(oldCursor, newCursor, candidates[0].id, newToOld))
+		return false;
+
+	std::unordered_map<const void*, const void*> oldToNew;
+	for (auto& [newId, oldNode] : newToOld)
+		oldToNew[oldNode.id] = newId;
+
+	// the root node id is the address of the tree's root field, it's different for every copy.
+	oldToNew[ts_tree_root_node(builtTree.get()).id] = newRoot.id;
+
+	// lambdas and such don't get scopes, so take the innermost candidate we built a function scope for.
+	TSNode oldScopeNode = {};
+	TSNode newScopeNode = {};
+	ScopeHandle handle = { ScopeHandle::none };
+	for (auto& candidate : candidates)
+	{
+		auto matched = newToOld.find(candidate.id);
+		if (matched == newToOld.end())
+			continue;
+
+		auto scopeIt = _nodeToScopes->find(matched->second.id);
+		if (scopeIt == _nodeToScopes->end() || GetScope(scopeIt->second)->associatedType == TypeHandle::Null())
+			continue;
+
+		oldScopeNode = matched->second;
+		newScopeNode = candidate;
+		handle = scopeIt->second;
+		break;
+	}
+
+	if (handle.index == ScopeHandle::none || ts_node_start_byte(oldScopeNode) != ts_node_start_byte(newScopeNode))
+		return false;
+
+	std::lock_guard checkLock(checkMutex);
+
+	auto dirtyStatus = Status::dirty;
+	if (!status.compare_exchange_strong(dirtyStatus, Status::buliding))
+	{
+		ts_tree_delete(newTree);
+		return true;
+	}
+
+	// the declarations that stay get their offsets shifted to the new text, so they read names from it too.
+	text = std::move(newText);
+	buffer = text.get();
+
+	auto scopeStart = ts_node_start_byte(newScopeNode);
+	auto oldEnd = ts_node_end_byte(oldScopeNode);
+	auto delta = (int64_t)ts_node_end_byte(newScopeNode) - (int64_t)oldEnd;
+
+	// everything nested in the rebuilt scope goes back on the free list, the present bits mark what survives.
+	std::vector<bool> onFreeList(scopeKings.size());
+	for (auto freeHandle : scopeKingFreeList)
+		onFreeList[freeHandle.index] = true;
+
+	ClearScopePresentBits();
+	std::vector<ScopeHandle> freed;
+	for (uint32_t i = 0; i < scopeKings.size(); i++)
+	{
+		if (onFreeList[i])
+			continue;
+
+		bool nested = false;
+		auto parent = scopeKings[i].parent;
+		for (size_t depth = 0; parent.index != ScopeHandle::none && depth < scopeKings.size(); depth++)
 		{
-			auto parent = ts_node_parent(newScopeNode);
-			auto parentSymbol = ts_node_symbol(parent);
-			if (parentSymbol == g_constants.funcDefinition)
+			if (parent.index == handle.index)
 			{
-				newScopeNode = parent;
+				nested = true;
+				break;
 			}
 
-			break;
+			parent = scopeKings[parent.index].parent;
 		}
 
-		newScopeNode = ts_node_parent(newScopeNode);
+		if (nested)
+			freed.push_back({ i });
+		else
+			SetScopePresentBit({ i });
 	}
 
-	if (ts_node_is_null(newScopeNode))
+	for (auto freedHandle : freed)
 	{
-		// this is likely the file scope then.
-		newScopeNode = root;
+		// the function or struct a nested scope belongs to can't be seen from outside the rebuilt one, so neither can its type.
+		auto scope = MutableScope(freedHandle);
+		if (scope->associatedType != TypeHandle::Null() && scope->associatedType.fileIndex == fileIndex)
+			typeKingFreeList.push_back(scope->associatedType.index);
+
+		scope->Clear();
+		scope->associatedType = TypeHandle::Null();
+		scope->checked = false;
+		scope->parent = { ScopeHandle::none };
+		scopeKingFreeList.push_back(freedHandle);
 	}
 
-	int startByte = ts_node_start_byte(newScopeNode);
+	// move the node ids over to the new tree. if/else/while nodes in the rebuilt scope point at it and get found again.
+	// the maps are new ones, the old ones can be a snapshot's.
+	auto nodeToScopes = std::make_shared<std::unordered_map<const void*, ScopeHandle>>();
+	for (auto& [id, scopeHandle] : *_nodeToScopes)
+	{
+		if (!IsScopePresent(scopeHandle) || scopeHandle.index == handle.index)
+			continue;
 
-	// fix up scope hashtable
-	//FixUpHashmapOffsets(offsetToHandle, edits, editCount);
+		auto moved = oldToNew.find(id);
+		(*nodeToScopes)[moved == oldToNew.end() ? id : moved->second] = scopeHandle;
+	}
 
-	auto uneditedStart = startByte;
-	for (int i = 0; i < editCount; i++)
+	(*nodeToScopes)[newScopeNode.id] = handle;
+	_nodeToScopes = std::move(nodeToScopes);
+
+	Hashmap newOffsets;
+	auto offsets = offsetToHandle->Data();
+	auto offsetCount = offsetToHandle->Size();
+	for (size_t i = 0; i < offsetCount; i++)
 	{
-		uneditedStart = UnEditStartByte(uneditedStart, edits[i].start_byte, edits[i].new_end_byte, edits[i].old_end_byte);
+		auto offset = offsets[i].key;
+		auto scopeHandle = offsets[i].value;
+		if (!IsScopePresent(scopeHandle) || (scopeHandle.index == handle.index && offset != (int)scopeStart))
+			continue;
+
+		if (offset >= (int)oldEnd)
+			offset = (int)(offset + delta);
+
+		newOffsets.Add(offset, scopeHandle);
+	}
+
+	offsetToHandle = ShareOffsets(newOffsets);
+
+	// the declarations after the rebuilt scope move by delta. that's logged instead of made, the tables can be a snapshot's.
+	if (delta != 0)
+		shiftLog.shifts.push_back({ oldEnd, (int32_t)delta });
+
+	// the rhs ids move over to the new tree too. tree-sitter reuses the nodes it didn't reparse, so only the few on the path
+	// down to the edit get new ids, and only the scopes with one of those get a table of their own.
+	for (uint32_t i = 0; i < scopeKings.size(); i++)
+	{
+		if (!IsScopePresent({ i }) || i == handle.index)
+			continue;
+
+		auto scope = &scopeKings[i];
+		auto size = scope->declarations.Size();
+		for (size_t j = 0; j < size; j++)
+		{
+			auto decl = scope->declarations[j];
+			if (decl.HasFlags(DeclarationFlags::Evaluated))
+				continue;
+
+			auto moved = oldToNew.find(decl.id);
+			if (moved == oldToNew.end() || moved->second == decl.id)
+				continue;
+
+			scope = MutableDeclarations({ i });
+			scope->declarations.Declarations()[j].id = moved->second;
+		}
 	}
 
-	if (uneditedStart == 0)
+	// every read of a start goes through the moves its scope hasn't taken in, so once there are a lot of them they're all taken in.
+	if (shiftLog.shifts.size() >= 32)
 	{
-		// then this is the file scope, probably.
+		for (uint32_t i = 0; i < scopeKings.size(); i++)
+		{
+			if (i != handle.index && scopeKings[i].shiftsApplied < shiftLog.End() && scopeKings[i].declarations.Size() > 0)
+				MutableDeclarations({ i });
+		}
+
+		shiftLog.base = shiftLog.End();
+		shiftLog.shifts.clear();
 	}
 
-	// first find which node the newScopeNode corresponds to by correlating it with the old node by start-byte
-	auto scopeIndex = offsetToHandle.GetIndex(uneditedStart);
+	// now find the declarations again, the same way Build would have gotten to this scope.
+	auto scope = MutableScope(handle);
+	scope->Clear();
+	scope->tableEpoch = publishes;
+	scope->shiftsApplied = shiftLog.End();
+	scope->checked = false;
 
-	if (scopeIndex != -1)
+	auto king = MutableType(scope->associatedType);
+	king->parameters.clear();
+	king->returnTypes.clear();
+
+	this->edits = nullptr;
+	this->editCount = 0;
+	currentTree = newTree;
+
+	bool exporting = scope->exportingIn;
+	auto exportingOut = scope->exportingOut;
+	FindDeclarations(newScopeNode, handle, exporting);
+
+	if (exporting != exportingOut)
 	{
-		auto handle = offsetToHandle[scopeIndex];
+		// a #scope_export/#scope_file changed what the rest of the file exports.
+		status = Status::dirty;
+		return false;
+	}
 
-		// yay now rebuild the scope somehow!
+	builtTree = std::shared_ptr<TSTree>(newTree, ts_tree_delete);
 
-		// first generate the scope stack
-		ScopeStack stack;
+	// a type worked out anywhere in the file could have come from what was just rebuilt.
+	memo.Reset(scopeKings.size());
+	status = Status::scopesBuilt;
+	return true;
+}
 
-		TSNode newNode = newScopeNode;
-		newNode = ts_node_parent(newNode);
 
-		while (!ts_node_is_null(newNode))
-		{
-			auto index = offsetToHandle.GetIndex(ts_node_start_byte(newNode));
-			if (index != -1)
-			{
-				auto handle = offsetToHandle[index];
-				stack.scopes.push_back(handle);
-			}
+static std::string DescribeType(FileScope* fileScope, TypeHandle type)
+{
+	if (type == TypeHandle::Null())
+		return "null";
 
-			newNode = ts_node_parent(newNode);
+	return std::string(fileScope->GetType(type)->name) + "/" + std::to_string(type.attributes);
+}
+
+// the correctness oracle for RebuildScope. builds the same tree from scratch and diffs the two, scope by scope.
+// handles and type indices are allowed to differ, so the scopes get matched up through the nodes they belong to.
+// returns the number of mismatches, which are described in report.
+int FileScope::CompareWithFullRebuild(std::string& report)
+{
+	if (status == Status::scopesBuilt)
+	{
+		WaitForDependencies();
+		DoTypeCheckingAndInference(currentTree);
+		status = Status::checked;
+	}
+
+	// the rebuilt file stands in for this one while it is checked, type handles find their file through its index.
+	// it's pinned on this thread only, every other thread still finds this one.
+	auto rebuilt = new FileScope();
+	rebuilt->documentHash = documentHash;
+	rebuilt->fileIndex = fileIndex;
+	rebuilt->lazy = lazy;
+
+	SnapshotPin pin(rebuilt);
+	rebuilt->Build(ts_tree_copy(builtTree.get()), text);
+	rebuilt->WaitForDependencies();
+	rebuilt->DoTypeCheckingAndInference(rebuilt->currentTree);
+
+	int mismatches = 0;
+	auto mismatch = [&](const std::string& what)
+	{
+		mismatches++;
+		report += what;
+		report += "\n";
+	};
+
+	if (rebuilt->_nodeToScopes->size() != _nodeToScopes->size())
+		mismatch("node count: " + std::to_string(_nodeToScopes->size()) + " expected " + std::to_string(rebuilt->_nodeToScopes->size()));
+
+	std::unordered_map<uint32_t, uint32_t> handles; // rebuilt handle -> ours
+	handles[ScopeHandle::none] = ScopeHandle::none;
+	// the two trees are copies, only their roots have different ids.
+	auto rebuiltRoot = ts_tree_root_node(rebuilt->builtTree.get()).id;
+	auto root = ts_tree_root_node(builtTree.get()).id;
+	for (auto& [id, rebuiltHandle] : *rebuilt->_nodeToScopes)
+	{
+		auto it = _nodeToScopes->find(id == rebuiltRoot ? root : id);
+		if (it == _nodeToScopes->end())
+		{
+			mismatch("missing scope " + std::to_string(rebuiltHandle.index));
+			continue;
 		}
 
-		std::reverse(stack.scopes.begin(), stack.scopes.end());
+		auto [existing, inserted] = handles.insert({ rebuiltHandle.index, it->second.index });
+		if (!inserted && existing->second != it->second.index)
+			mismatch("scope " + std::to_string(rebuiltHandle.index) + " maps to both " + std::to_string(existing->second) + " and " + std::to_string(it->second.index));
+	}
 
-		GetScope(handle)->Clear();
-		bool exporting;
+	for (auto [rebuiltIndex, index] : handles)
+	{
+		if (rebuiltIndex == ScopeHandle::none)
+			continue;
 
-		_nodeToScopes.clear();
-		FindDeclarations(newScopeNode, handle, exporting, true);
-		
-		ClearScopePresentBits();
-		DoTokens(root, edits, editCount);
+		auto expected = rebuilt->GetScope({ rebuiltIndex });
+		auto actual = GetScope({ index });
+		auto name = "scope " + std::to_string(index) + ": ";
 
-		// now iterate through the bitmaps and free old scopes.
-		auto& current = scopePresentBitmap[whichBitmap];
-		auto& previous = scopePresentBitmap[(whichBitmap + 1) % 2];
+		auto parent = handles.find(expected->parent.index);
+		if (parent == handles.end() || parent->second != actual->parent.index)
+			mismatch(name + "parent " + std::to_string(actual->parent.index));
 
-		for (int i = 0; i < scopePresentBitmap[0].size(); i++)
+		if (expected->declarations.Size() != actual->declarations.Size())
+			mismatch(name + "declaration count " + std::to_string(actual->declarations.Size()) + " expected " + std::to_string(expected->declarations.Size()));
+
+		if ((expected->associatedType == TypeHandle::Null()) != (actual->associatedType == TypeHandle::Null()))
+		{
+			mismatch(name + "associated type");
+		}
+		else if (expected->associatedType != TypeHandle::Null())
 		{
-			auto bits = ~previous[i] & current[i];
+			auto expectedKing = rebuilt->GetType(expected->associatedType);
+			auto actualKing = GetType(actual->associatedType);
+			if (expectedKing->name != actualKing->name || expectedKing->parameters != actualKing->parameters || expectedKing->returnTypes.size() != actualKing->returnTypes.size())
+				mismatch(name + "type " + std::string(actualKing->name) + " expected " + std::string(expectedKing->name));
+		}
 
-			while (bits > 0)
+		auto size = expected->declarations.Size();
+		auto keys = expected->declarations.Keys();
+		auto data = expected->declarations.Declarations();
+		for (size_t i = 0; i < size; i++)
+		{
+			auto key = keys[i];
+			auto declName = name + "declaration at " + std::to_string(data[i].startByte) + " ";
+
+			auto index = actual->GetIndex(key);
+			if (index < 0)
 			{
-				unsigned long firstHigh;
-				_BitScanReverse64(&firstHigh, bits);
+				mismatch(declName + "missing");
+				continue;
+			}
+
+			auto expectedDecl = data[i];
+			auto actualDecl = *actual->GetDeclFromIndex(index);
+			if ((actual->declarations.MatchFlags(index, (DeclarationFlags)UINT16_MAX, actualDecl.flags) & 1) == 0)
+				mismatch(declName + "flags column out of date");
+
+			auto actualStart = DeclarationStart(actual, actualDecl);
+			if (actualStart != expectedDecl.startByte || actualDecl.GetLength() != expectedDecl.GetLength())
+				mismatch(declName + "moved to " + std::to_string(actualStart));
 
-				// free scope.
-				auto scopeIndex = (i * 64) + firstHigh;
-				scopeKingFreeList.push_back({ (uint16_t)scopeIndex });
-				bits &= ~(1 << firstHigh); // clear bit for current scope
+			if ((actualDecl.flags & ~DeclarationFlags::ForeignOffset) != (expectedDecl.flags & ~DeclarationFlags::ForeignOffset))
+			{
+				mismatch(declName + "flags " + std::to_string(actualDecl.flags) + " expected " + std::to_string(expectedDecl.flags));
+				continue;
 			}
-		}
 
+			if (!expectedDecl.HasFlags(DeclarationFlags::Evaluated) && (actualDecl.id != expectedDecl.id || actualDecl.GetRHSOffset() != expectedDecl.GetRHSOffset()))
+				mismatch(declName + "rhs node");
 
+			// both sides work the type out the way a query would. this file's handles have to lead back to it for its side.
+			std::optional<TypeHandle> actualType;
+			{
+				SnapshotPin self(this);
+				actualType = InferDeclarationType(actual, index);
+			}
+			auto expectedType = rebuilt->InferDeclarationType(expected, (int)i);
+			auto actualName = actualType ? DescribeType(this, *actualType) : "none";
+			auto expectedName = expectedType ? DescribeType(rebuilt, *expectedType) : "none";
+			if (actualName != expectedName)
+				mismatch(declName + "type " + actualName + " expected " + expectedName);
+		}
 	}
-	*/
+
+	delete rebuilt;
+
+	return mismatches;
+}
+
+
+// the scopes and types for a snapshot. nothing's copied but page and table pointers, the file copies a page or a table
+// before it next writes to it, so a publish after an incremental rebuild only costs what the rebuild touched.
+// the snapshot keeps the tree, the maps and the arena the tables are in alive for as long as it's around.
+std::shared_ptr<FileScope> FileScope::CloneAnalysis()
+{
+	auto clone = std::make_shared<FileScope>();
+	clone->documentHash = documentHash;
+	clone->fileIndex = fileIndex;
+	clone->builtTree = builtTree;
+	clone->currentTree = builtTree.get();
+	clone->imports = imports;
+	clone->loads = loads;
+	clone->types = types;
+	clone->offsetToHandle = offsetToHandle;
+	clone->scopeKings = scopeKings;
+	clone->_nodeToScopes = _nodeToScopes;
+	clone->arenas[0] = arenas[whichArena];
+	clone->shiftLog = shiftLog;
+	clone->text = text;
+	clone->buffer = buffer;
+	clone->file = file;
+	clone->builtGeneration = builtGeneration.load();
+	clone->status = Status::checked;
+	clone->published = true;
+	clone->memo.Reset(clone->scopeKings.size());
+
+	// every table there is now is the snapshot's too.
+	publishes++;
+	return clone;
 }
 
+// type checks the scopes if they haven't been yet, then publishes a snapshot of them on the document.
+// the types of the declarations and the tokens are left for the queries that ask for them.
+// returns null if the scopes aren't built yet.
+SnapshotRecord FileScope::PublishSnapshot()
+{
+	if (status == Status::scopesBuilt)
+		CheckWithDependencies();
+
+	std::lock_guard lock(checkMutex);
+	if (status != Status::checked || !builtTree)
+		return nullptr;
 
+	return PublishChecked();
+}
+
+// publishes the checked scopes, the caller holds the check lock so they can't be rebuilt while it's going.
+// the dependency waves publish every file they check, so a query finds a snapshot of anything it has a handle into.
+// a file restored from the index cache has no tree, its snapshot is only there for the files that look things up in it.
+SnapshotRecord FileScope::PublishChecked()
+{
+	// someone else got here first.
+	auto current = GetDocument(documentHash)->snapshot;
+	if (current && current->generation == builtGeneration)
+		return current;
+
+	auto snapshot = std::make_shared<Snapshot>();
+	snapshot->generation = builtGeneration;
+	snapshot->tree = builtTree;
+	snapshot->text = text;
+	snapshot->analysis = CloneAnalysis();
+
+	SnapshotRecord record = snapshot;
+	UpdateDocument(documentHash, [&](Document& document) { document.snapshot = record; });
+	return record;
+}
@@ -1,8 +1,11 @@
 #pragma once
 #include "TreeSitterJai.h"
 #include "Hashmap.h"
+#include "EditJournal.h"
 #include <assert.h>
-#include <future>
+#include "TaskScheduler.h"
+#include "Arena.h"
+#include "PagedVector.h"
 
 struct ScopeStack
 {
@@ -10,29 +13,88 @@ struct ScopeStack
 };
 
 
+// the types InferDeclarationType worked out, kept next to the declarations instead of in them. a snapshot's scopes are only
+// read, and any number of queries fill in its memo at once: a slot's state is claimed by the thread that works it out,
+// and the type goes in before the state says it's there. a column per scope, made the first time something in it is asked for.
+class InferenceMemo
+{
+public:
+	enum State : uint8_t
+	{
+		unknown,
+		evaluating, // some thread is working it out
+		evaluated,
+		unresolved, // it has no type, and won't get one later
+	};
+
+	struct Slot
+	{
+		std::atomic<State> state = unknown;
+		TypeHandle type;
+	};
+
+	InferenceMemo() = default;
+	~InferenceMemo();
+	InferenceMemo(const InferenceMemo&) = delete;
+	InferenceMemo& operator=(const InferenceMemo&) = delete;
+
+	// null for a scope the memo wasn't made big enough for, the type gets worked out without being kept.
+	Slot* Get(uint32_t scope, uint32_t index, uint32_t declarationCount);
+	void Reset(size_t scopeCount); // only while nothing else is reading it
+	size_t CountEvaluated() const;
+
+private:
+	struct Column
+	{
+		uint32_t count;
+		Slot* slots;
+	};
+
+	std::atomic<Column*>* columns = nullptr;
+	size_t columnCount = 0;
+	std::mutex growMutex; // taken to make a column, never to read one
+	std::vector<Column*> retired; // columns a live file's using outgrew, someone could still be holding a slot in one
+
+	void Free();
+};
+
+
 
 struct FileScope
 {
 	Hash documentHash;
-	uint16_t fileIndex;
+	uint32_t fileIndex;
 	TSTree* currentTree;
+	std::shared_ptr<TSTree> builtTree; // the tree the scopes were built from, edits to the live tree don't touch it. snapshots share it
 
 	std::vector<Hash> imports;
 	std::vector<Hash> loads;
-	std::vector<TypeKing> types;
+	PagedVector<TypeKing> types; // shares its pages with the snapshots, see MutableType
+	std::vector<uint32_t> typeKingFreeList; // types of scopes an incremental rebuild dropped
 	
-	Hashmap offsetToHandle;
+	std::shared_ptr<Hashmap> offsetToHandle = ShareOffsets(Hashmap()); // a snapshot can hold it, a rebuild makes a new one
 
-	std::vector<Scope> scopeKings;
+	PagedVector<Scope> scopeKings; // shares its pages with the snapshots, see MutableScope
 	std::vector<ScopeHandle> scopeKingFreeList;
 
 	std::vector<uint64_t> scopePresentBitmap[2];
 	int whichBitmap = 0;
 
+	// the scope tables of a build come out of one arena, and a full rebuild resets an arena instead of freeing every table.
+	// there are two, a rebuild takes the other one. other files read these scopes without locking this one,
+	// so the tables of the build before stay where they were until the one after. a snapshot keeps its arena alive,
+	// if it still has the one a rebuild would take, the rebuild gets a new one.
+	std::shared_ptr<Arena> arenas[2] = { std::make_shared<Arena>(), std::make_shared<Arena>() };
+	int whichArena = 0;
+
 	//Hashmap<const void*, ScopeHandle>  idToHandle;
-	std::unordered_map<const void*, ScopeHandle> _nodeToScopes;
+	std::shared_ptr<std::unordered_map<const void*, ScopeHandle>> _nodeToScopes = std::make_shared<std::unordered_map<const void*, ScopeHandle>>();
+	ShiftLog shiftLog; // the moves of the incremental rebuilds since the last full one
+	uint32_t publishes = 0; // snapshots made of the scopes, a table made before the last one is the snapshot's too
+	std::once_flag tokensFound; // a snapshot's tokens are worked out by the first query that wants them
 	std::vector<SemanticToken> tokens;
 	const GapBuffer* buffer;
+	std::shared_ptr<const GapBuffer> text; // keeps buffer alive, it's the text the scopes were built from
 	ScopeHandle file;
 
 	Cursor scope_builder_cursor;
@@ -50,10 +112,21 @@ struct FileScope
 	bool declarationsFound;
 	*/
 
-	TSInputEdit* edits;
-	int editCount;
+	TSInputEdit* edits = nullptr;
+	int editCount = 0;
+
+	EditJournal journal;
+	std::atomic<uint64_t> builtGeneration = 0; // the journal generation the scopes were last built from
 
-	std::vector<std::future<bool>> loadFutures;
+	// held while the tree is being reparsed, edits wait on it. it isn't held while the scopes are built,
+	// a build starts #loads that take the parse mutex of other files, and those can #load this one.
+	std::mutex parseMutex;
+	std::atomic<size_t> cancelParse = 0; // tree-sitter polls this, non zero abandons the parse
+	TSParser* pendingParser = nullptr; // a parse that ran out of time, the next UpdateTree resumes it
+	uint64_t pendingGeneration = 0; // the journal generation pendingParser started parsing from
+
+	std::vector<TaskHandle> loadTasks;
+	std::mutex checkMutex; // held while a dependency wave type checks this file, and while its scopes are built
 	std::vector<std::pair<ScopeHandle, TypeHandle>> usings;
 
 	enum class Status
@@ -66,21 +139,40 @@ struct FileScope
 
 	std::atomic<Status> status = Status::dirty;
 
-	static constexpr bool INCREMENTAL_ANALYSIS = false;
+	// loaded for another file's sake, only the parameters of its functions are found, not what's in their bodies.
+	// nothing outside a function can see into it, and a file has to be opened for a query to land in one.
+	bool lazy = false;
+
+	// a snapshot's analysis. its scopes and types are only read, the memo is all that's written to after it's made,
+	// and a declaration that can't be worked out won't be once its neighbours are.
+	bool published = false;
+
+	InferenceMemo memo; // started over whenever the scopes are (re)built
+
+	static constexpr bool INCREMENTAL_ANALYSIS = true;
+	static constexpr bool VERIFY_INCREMENTAL_ANALYSIS = false; // compares every incremental rebuild against a full one, slow!
 
 	void Clear()
 	{
+		whichArena = (whichArena + 1) % 2;
+		if (arenas[whichArena].use_count() > 1)
+			arenas[whichArena] = std::make_shared<Arena>();
+		else
+			arenas[whichArena]->Reset();
+
 		imports.clear();
 		loads.clear();
-		loadFutures.clear();
+		loadTasks.clear();
 		types.clear();
-		_nodeToScopes.clear();
+		typeKingFreeList.clear();
+		_nodeToScopes = std::make_shared<std::unordered_map<const void*, ScopeHandle>>();
 		tokens.clear();
 		scopeKings.clear();
 		scopeKingFreeList.clear();
 		scopePresentBitmap[0].clear();
 		scopePresentBitmap[1].clear();
-		offsetToHandle.Clear();
+		offsetToHandle = ShareOffsets(Hashmap());
+		shiftLog = ShiftLog();
 	}
 
 
@@ -99,14 +191,60 @@ struct FileScope
 
 	void HandleVariableReference(TSNode node, Scope* scope);
 
+	Arena* CurrentArena()
+	{
+		return arenas[whichArena].get();
+	}
+
+	// a copy of some text that lives as long as this build's scopes, zero terminated. for names that aren't identifiers,
+	// like function signatures, which would only fill up the identifier table.
+	std::string_view StoreName(std::string_view text)
+	{
+		auto stored = (char*)CurrentArena()->Allocate(text.size() + 1, 1);
+		memcpy(stored, text.data(), text.size());
+		stored[text.size()] = '\0';
+		return std::string_view(stored, text.size());
+	}
+
+	// the map a snapshot shares, it's freed with the last one holding it.
+	static std::shared_ptr<Hashmap> ShareOffsets(Hashmap offsets)
+	{
+		return std::shared_ptr<Hashmap>(new Hashmap(offsets), [](Hashmap* map) { map->Clear(); delete map; });
+	}
+
+	// scopes get handed around as pointers, the memo goes by index. UINT32_MAX for a scope that isn't this file's,
+	// or one on a page the file has copied since, that one is a snapshot's.
+	uint32_t ScopeIndexOf(const Scope* scope) const
+	{
+		if (scope->index >= scopeKings.size() || &scopeKings[scope->index] != scope)
+			return UINT32_MAX;
+
+		return scope->index;
+	}
+
+	// for reading. a snapshot can share the page it's on, writes go through MutableScope.
 	Scope* GetScope(ScopeHandle handle)
 	{
-		if (handle.index == UINT16_MAX)
+		if (handle.index == ScopeHandle::none)
 			return nullptr;
 
 		return &scopeKings[handle.index];
 	}
 
+	// the scope on a page of this file's own. its table can still be a snapshot's, MutableDeclarations is for writing to that.
+	Scope* MutableScope(ScopeHandle handle)
+	{
+		return &scopeKings.Mutable(handle.index);
+	}
+
+	Scope* MutableDeclarations(ScopeHandle handle);
+
+	// where a declaration of one of this file's scopes starts in the text the scopes were last built from.
+	uint32_t DeclarationStart(const Scope* scope, const ScopeDeclaration& decl) const
+	{
+		return scope->DeclarationStart(decl, shiftLog);
+	}
+
 	void ClearScopePresentBits()
 	{
 		whichBitmap = (whichBitmap + 1) % 2;
@@ -122,12 +260,20 @@ struct FileScope
 		auto index = handle.index;
 		auto bitmapElement = index >> 6;
 		auto bitIndex = index % 64;
-		scopePresentBitmap[whichBitmap][bitmapElement] &= ~(1 << bitIndex);
+		scopePresentBitmap[whichBitmap][bitmapElement] &= ~(1ull << bitIndex);
+	}
+
+	bool IsScopePresent(ScopeHandle handle)
+	{
+		auto index = handle.index;
+		auto bitmapElement = index >> 6;
+		auto bitIndex = index % 64;
+		return (scopePresentBitmap[whichBitmap][bitmapElement] & (1ull << bitIndex)) == 0;
 	}
 
 	bool ContainsScope(const void* id)
 	{
-		return _nodeToScopes.contains(id);
+		return _nodeToScopes->contains(id);
 	}
 
 	static int EditStartByte(int start_byte, int edit_start_byte, int new_end_byte, int old_end_byte)
@@ -195,7 +341,7 @@ struct FileScope
 		{
 			offset = UnEditStartByte(offset, edits[i].start_byte, edits[i].new_end_byte, edits[i].old_end_byte);
 		}
-		return offsetToHandle.Contains(offset);
+		return offsetToHandle->Contains(offset);
 	}
 
 	std::optional<ScopeHandle> GetScopeFromOffset(int offset, TSInputEdit* edits, int editCount)
@@ -205,11 +351,11 @@ struct FileScope
 			offset = UnEditStartByte(offset, edits[i].start_byte, edits[i].new_end_byte, edits[i].old_end_byte);
 		}
 
-		int index = (int)offsetToHandle.GetIndex(offset);
+		int index = (int)offsetToHandle->GetIndex(offset);
 
 		if (index >= 0)
 		{
-			return offsetToHandle[index];
+			return (*offsetToHandle)[index];
 		}
 
 		return std::nullopt;
@@ -219,14 +365,14 @@ struct FileScope
 	ScopeHandle GetScopeFromNodeID(const void* id)
 	{
 		assert(ContainsScope(id));
-		return _nodeToScopes[id];
+		return _nodeToScopes->find(id)->second;
 	}
 
 
 	std::optional<ScopeHandle> TryGetScopeFromNodeID(const void* id)
 	{
-		auto it = _nodeToScopes.find(id);
-		if (it == _nodeToScopes.end())
+		auto it = _nodeToScopes->find(id);
+		if (it == _nodeToScopes->end())
 			return std::nullopt;
 
 		return it->second;
@@ -240,16 +386,22 @@ struct FileScope
 		{
 			auto back = scopeKingFreeList.back();
 			scopeKingFreeList.pop_back();
-			_nodeToScopes[node.id] = back;
-			GetScope(back)->Clear();
-			GetScope(back)->parent = parent;
-			GetScope(back)->imperative = imperative;
-			offsetToHandle.Add(node.context[0], back);
+			(*_nodeToScopes)[node.id] = back;
+			auto scope = MutableScope(back);
+			scope->Clear();
+			scope->tableEpoch = publishes;
+			scope->shiftsApplied = shiftLog.End();
+			scope->associatedType = TypeHandle::Null();
+			scope->checked = false;
+			scope->parent = parent;
+			scope->imperative = imperative;
+			offsetToHandle->Add(node.context[0], back);
 
 			return back;
 		}
 
-		scopeKings.push_back(Scope());
+		assert(scopeKings.size() < ScopeHandle::none);
+		scopeKings.push_back(Scope{ .declarations = Scopemap(CurrentArena()), .imperative = imperative, .parent = parent, .tableEpoch = publishes, .shiftsApplied = shiftLog.End(), .index = (uint32_t)scopeKings.size() });
 		auto numberOfBitwords = (scopeKings.size() >> 6) + 1;
 		if (numberOfBitwords > scopePresentBitmap[0].size())
 		{
@@ -257,19 +409,27 @@ struct FileScope
 			scopePresentBitmap[1].push_back(UINT64_MAX);
 		}
 
-		auto handle = ScopeHandle{ .index = static_cast<uint16_t>(scopeKings.size() - 1) };
-		GetScope(handle)->parent = parent;
-		GetScope(handle)->imperative = imperative;
-		_nodeToScopes.insert(std::make_pair(node.id, handle));
-		offsetToHandle.Add(node.context[0], handle);
+		auto handle = ScopeHandle{ .index = static_cast<uint32_t>(scopeKings.size() - 1) };
+		_nodeToScopes->insert(std::make_pair(node.id, handle));
+		offsetToHandle->Add(node.context[0], handle);
 		return handle;
 	}
 
 
 	TypeHandle AllocateType()
 	{
+		if (typeKingFreeList.size() > 0)
+		{
+			auto index = typeKingFreeList.back();
+			typeKingFreeList.pop_back();
+			types.Mutable(index) = TypeKing();
+
+			return TypeHandle{ .fileIndex = fileIndex, .index = index };
+		}
+
+		assert(types.size() < TypeHandle::none);
 		types.push_back(TypeKing());
-		return TypeHandle{ .fileIndex = fileIndex, .index = static_cast<uint16_t>(types.size() - 1) };
+		return TypeHandle{ .fileIndex = fileIndex, .index = static_cast<uint32_t>(types.size() - 1) };
 	}
 
 	TypeKing* GetType(TypeHandle handle)
@@ -279,7 +439,14 @@ struct FileScope
 		if(handle.fileIndex == fileIndex)
 			return &types[handle.index];
 
-		return &g_fileScopeByIndex.Read(handle.fileIndex)->types[handle.index];
+		return &GetFileScope(handle.fileIndex)->types[handle.index];
+	}
+
+	// one of this file's types, on a page of its own. GetType is for reading, a snapshot can share the page.
+	TypeKing* MutableType(TypeHandle handle)
+	{
+		assert(handle.fileIndex == fileIndex);
+		return &types.Mutable(handle.index);
 	}
 
 
@@ -293,16 +460,27 @@ struct FileScope
 	TypeHandle HandleFuncDefinitionNode(TSNode node, ScopeHandle currentScope, std::vector<TSNode>& structs, DeclarationFlags& flags);
 	void HandleImportNode(TSNode node);
 	void HandleLoadNode(TSNode node);
+	void LoadModule(Hash moduleNameHash, buffer_view moduleName); // only copies the name out if the module is new
+	void LoadModule(Hash moduleNameHash, const std::string& moduleName);
+	void LoadFile(const std::string& path);
 	void CreateTopLevelScope(TSNode node, ScopeStack& stack, bool& exporting);
+	std::optional<TypeHandle> InferDeclarationType(Scope* scope, int index);
 	void CheckScope(Scope* scope);
 	void DoTypeCheckingAndInference(TSTree* tree);
 	void WaitForDependencies();
+	void CheckWithDependencies();
+	void Build(TSTree* tree, std::shared_ptr<const GapBuffer> treeText);
 	void Build();
+	void DropPendingParse();
 	void DoTokens2();
 	void DoTokens(TSNode root, TSInputEdit* edits, int editCount);
 	const std::optional<TypeHandle> GetTypeFromSymbol(TSNode node, Scope* scope, TSSymbol symbol);
 	const std::optional<TypeHandle> EvaluateNodeExpressionType(TSNode node, Scope* scope);
-	void RebuildScope(TSNode newScopeNode, TSInputEdit* edits, int editCount, TSNode root);
+	bool RebuildScope(TSTree* oldTree, TSTree* newTree, std::shared_ptr<const GapBuffer> newText, TSInputEdit* edits, int editCount);
+	int CompareWithFullRebuild(std::string& report);
+	std::shared_ptr<FileScope> CloneAnalysis();
+	SnapshotRecord PublishSnapshot();
+	SnapshotRecord PublishChecked();
 
 
 };
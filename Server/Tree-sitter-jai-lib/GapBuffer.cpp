@@ -1,208 +1,293 @@
 #include "GapBuffer.h"
+#include "Newlines.h"
 
 #include <assert.h>
+#include <algorithm>
 #include <iostream>
 
-char GapBuffer::Advance()
+void GapBuffer::MoveGap(uint32_t offset)
 {
-    before.push_back(after.back());
-    after.pop_back();
+    Promote();
 
-    return before.back();
+    if (offset < gapStart)
+    {
+        auto count = gapStart - offset;
+        Move(gapEnd - count, offset, count);
+        gapStart -= count;
+        gapEnd -= count;
+    }
+    else if (offset > gapStart)
+    {
+        auto count = offset - gapStart;
+        Move(gapStart, gapEnd, count);
+        gapStart += count;
+        gapEnd += count;
+    }
 }
 
-char GapBuffer::Retreat()
+void GapBuffer::EnsureGap(uint32_t length)
 {
-    after.push_back(before.back());
-    before.pop_back();
+    Promote();
 
-    return after.back();
+    auto gapSize = gapEnd - gapStart;
+    if (gapSize >= length)
+        return;
+
+    auto oldSize = Capacity();
+    auto tailSize = oldSize - gapEnd;
+    AddChunks(length + std::max(minimumGap, oldSize / 2));
+
+    auto newSize = Capacity();
+    Move(newSize - tailSize, gapEnd, tailSize);
+    gapEnd = newSize - tailSize;
 }
 
-void GapBuffer::SeekLine(int line)
+// the mapping is read only, the first edit copies the text out into storage of our own.
+void GapBuffer::Promote()
 {
-    while (currentLine < line)
+    if (!mapped)
+        return;
+
+    auto file = std::move(mapped);
+    auto size = static_cast<uint32_t>(file->Size());
+    AddChunks(size + minimumGap);
+    Write(0, file->Data(), size);
+    gapStart = size;
+    gapEnd = Capacity();
+}
+
+uint32_t GapBuffer::Capacity() const
+{
+    return mapped ? static_cast<uint32_t>(mapped->Size()) : static_cast<uint32_t>(chunks.size() << chunkShift);
+}
+
+void GapBuffer::AddChunks(uint32_t bytes)
+{
+    auto count = (bytes + chunkMask) >> chunkShift;
+    for (uint32_t i = 0; i < count; i++)
+        chunks.push_back(std::make_shared_for_overwrite<Chunk>());
+}
+
+const char* GapBuffer::Run(uint32_t index, uint32_t* length) const
+{
+    if (mapped)
     {
-        if (Advance() == newline)
-        {
-            currentLine++;
-            currentCol = 0;
-        }
+        *length = Capacity() - index;
+        return mapped->Data() + index;
     }
 
-    while (currentLine > line)
+    *length = chunkSize - (index & chunkMask);
+    return chunks[index >> chunkShift]->bytes + (index & chunkMask);
+}
+
+char* GapBuffer::WritableRun(uint32_t index, uint32_t* length)
+{
+    // a chunk someone else still has a copy of gets copied before we write to it.
+    auto& chunk = chunks[index >> chunkShift];
+    if (chunk.use_count() > 1)
     {
-        if (Retreat() == newline)
-        {
-            currentLine--;
-            currentCol = -1;
-        }
+        auto copy = std::make_shared_for_overwrite<Chunk>();
+        memcpy(copy->bytes, chunk->bytes, chunkSize);
+        chunk = std::move(copy);
     }
+
+    *length = chunkSize - (index & chunkMask);
+    return chunk->bytes + (index & chunkMask);
 }
 
-void GapBuffer::CalculateCurrentColumnAtEdge()
+void GapBuffer::Write(uint32_t index, const char* content, uint32_t length)
 {
-    if (currentLine == 0)
+    while (length > 0)
     {
-        currentCol = static_cast<int>(before.size());
+        uint32_t run;
+        auto destination = WritableRun(index, &run);
+        auto count = std::min(run, length);
+        memcpy(destination, content, count);
+
+        index += count;
+        content += count;
+        length -= count;
     }
-    else
+}
+
+// memmove within the storage, a piece at a time so no piece crosses a chunk boundary on either side.
+void GapBuffer::Move(uint32_t to, uint32_t from, uint32_t count)
+{
+    if (to < from)
     {
-        int col = 0;
-        auto back = before.back();
-        while (back != newline)
+        while (count > 0)
         {
-            col++;
-            back = before[before.size() - 1 - col];
+            uint32_t destinationRun, sourceRun;
+            auto destination = WritableRun(to, &destinationRun);
+            auto source = Run(from, &sourceRun);
+            auto n = std::min({ count, destinationRun, sourceRun });
+            memmove(destination, source, n);
+
+            to += n;
+            from += n;
+            count -= n;
         }
+    }
+    else if (to > from)
+    {
+        // overlapping to the right, so it goes back to front.
+        while (count > 0)
+        {
+            auto toEnd = to + count;
+            auto fromEnd = from + count;
+            auto n = std::min({ count, toEnd - ((toEnd - 1) & ~chunkMask), fromEnd - ((fromEnd - 1) & ~chunkMask) });
+
+            uint32_t run;
+            auto destination = WritableRun(toEnd - n, &run);
+            auto source = Run(fromEnd - n, &run);
+            memmove(destination, source, n);
 
-        currentCol = col;
+            count -= n;
+        }
     }
 }
 
 GapBuffer::GapBuffer() {}
 
-bool GapBuffer::IsRewound()
+GapBuffer::GapBuffer(const GapBuffer& other) = default;
+GapBuffer& GapBuffer::operator=(const GapBuffer& other) = default;
+
+GapBuffer::GapBuffer(GapBuffer&& other) noexcept
+    : lines(std::move(other.lines)), chunks(std::move(other.chunks)), gapStart(other.gapStart), gapEnd(other.gapEnd), mapped(std::move(other.mapped))
 {
-    return after.size() == 0;
+    other.gapStart = other.gapEnd = 0;
 }
 
-void GapBuffer::Rewind()
+GapBuffer& GapBuffer::operator=(GapBuffer&& other) noexcept
 {
-    for (int i = 0; i < after.size(); i++)
+    if (this != &other)
     {
-        before.push_back(after.back());
-        after.pop_back();
+        lines = std::move(other.lines);
+        chunks = std::move(other.chunks);
+        gapStart = other.gapStart;
+        gapEnd = other.gapEnd;
+        mapped = std::move(other.mapped);
+
+        other.chunks.clear();
+        other.mapped.reset();
+        other.gapStart = other.gapEnd = 0;
     }
+
+    return *this;
 }
 
-char GapBuffer::GetChar(int index) const
+bool GapBuffer::IsRewound()
 {
+    return gapEnd == Capacity();
+}
 
-    if (index < before.size())
-    {
-        return before[index];
-    }
-    else
-    {
-        index -= static_cast<int>(before.size());
-        return after[after.size() - index - 1];
-    }
+void GapBuffer::Rewind()
+{
+    MoveGap(Size());
 }
 
-void GapBuffer::Seek(int line, int col)
+const char* GapBuffer::Read(uint32_t offset, uint32_t* bytesRead) const
 {
-    SeekLine(line);
-    if (currentCol == -1)
+    auto index = offset;
+    auto end = gapStart;
+    if (offset >= gapStart)
     {
-        CalculateCurrentColumnAtEdge();
+        index = offset + (gapEnd - gapStart);
+        end = Capacity();
     }
 
-    while (currentCol < col)
+    if (index >= end)
     {
-        Advance();
-        currentCol++;
+        *bytesRead = 0;
+        return nullptr;
     }
 
-    while (currentCol > col)
-    {
-        Retreat();
-        currentCol--;
-    }
+    uint32_t run;
+    auto text = Run(index, &run);
+    *bytesRead = std::min(run, end - index);
+    return text;
+}
+
+void GapBuffer::Seek(int line, int col)
+{
+    MoveGap(GetOffset(line, col));
 }
 
 void GapBuffer::InsertAtCursor(const char* content, int length)
 {
-    for (int i = 0; i < length; i++)
-    {
-        before.push_back(content[i]);
-        if (content[i] == newline)
-        {
-            currentLine++;
-            currentCol = 0;
-        }
-        else
-        {
-            currentCol++;
-        }
-    }
+    auto offset = GetOffset();
+    EnsureGap(length);
+    Write(gapStart, content, length);
+    gapStart += length;
+    lines.Replace(offset, offset, content, length);
 }
 
 GapBuffer::GapBuffer(const char* initialContent, int length)
 {
-    before.resize(length); 
-    memcpy(before.data(), initialContent, length);
-    
-    // seek end:
-    for (int i = 0; i < length; i++)
-    {
-        if (before[i] == newline)
-        {
-            currentLine++;
-            currentCol = 0;
-        }
-        else
-        {
-            currentCol++;
-        }
-    }
+    // the gap starts out at the end, so tree-sitter reads the text a chunk at a time without hitting it.
+    AddChunks(length + minimumGap);
+    Write(0, initialContent, length);
+    gapStart = length;
+    gapEnd = Capacity();
+    lines.Build(initialContent, length);
+}
 
-    //InsertAtCursor(initialContent, length);
+GapBuffer::GapBuffer(std::shared_ptr<const MappedFile> file)
+    : mapped(std::move(file))
+{
+    // nothing gets copied for the first parse, it reads the mapping. the caller unmaps once the tree is built.
+    gapStart = gapEnd = static_cast<uint32_t>(mapped->Size());
+    lines.Build(mapped->Data(), gapStart);
 }
 
-std::string_view GapBuffer::GetStringView(int start, int length)
+std::optional<std::string_view> GapBuffer::GetStringView(int start, int length)
 {
-    assert(IsRewound());
-    auto view = std::string_view(&before[start], length);
-    return view;
+    if (start < 0 || length < 0 || (uint32_t)start + (uint32_t)length > Size())
+        return std::nullopt;
+
+    if (length == 0)
+        return std::string_view();
+
+    uint32_t run;
+    auto text = Read(start, &run);
+    if (run < (uint32_t)length)
+        return std::nullopt;
+
+    return std::string_view(text, length);
 }
 
-std::string_view GapBuffer::GetEntireStringView()
+std::optional<std::string_view> GapBuffer::GetEntireStringView()
 {
-    assert(IsRewound());
-    auto view = std::string_view(before.data(), before.size());
-    return view;
+    return GetStringView(0, Size());
 }
 
-void GapBuffer::GetRowCopy(int row, std::string& s)
+void GapBuffer::GetRowCopy(int row, std::string& s) const
 {
-    if (row == currentLine)
-    {
-        s.reserve(currentCol);
-    }
-    else
-    {
-        Seek(row, 0);
-    }
+    if (row < 0 || row >= (int)lines.LineCount())
+        return;
+
+    auto lineStart = lines.LineStart(row);
+    auto lineEnd = lineStart + lines.LineLength(row);
+    s.reserve(s.size() + (lineEnd - lineStart));
 
-    auto currentByte = before.size();
-    auto lineStart = currentByte - currentCol;
-    int index = 0;
-    while ( (lineStart + index) < (before.size() + after.size()) )
+    for (auto i = lineStart; i < lineEnd; i++)
     {
-        auto character = GetChar((int)lineStart + index);
-        if ( character == '\n')
+        auto character = GetChar((int)i);
+        if (character == newline)
             break;
 
         s.push_back(character);
-
-        index++;
     }
 }
 
 
 TSPoint position_for_offset(char* input, int offset) {
-    auto result = TSPoint{ .row = 0, .column = 0 };
-    for (int i = 0; i <  offset; i++)
-        if (input[i] == '\n') {
-            result.row += 1;
-            result.column = 0;
-        }
-        else {
-            result.column += 1;
-        }
-        
-    return result;
+    auto row = CountNewlines(input, offset);
+    auto lineStart = offset;
+    while (lineStart > 0 && input[lineStart - 1] != '\n')
+        lineStart--;
+
+    return TSPoint{ .row = row, .column = static_cast<uint32_t>(offset - lineStart) };
 }
 
 TSInputEdit perform_edit(char* input, uint32_t editPosition, uint32_t deletedLength, uint32_t inserted_text_length ) {
@@ -230,19 +315,21 @@ TSInputEdit perform_edit(char* input, uint32_t editPosition, uint32_t deletedLen
 
 TSInputEdit GapBuffer::Edit(int line, int col, int endLine, int endCol, const char* content, int contentLength, int rangeLength)
 {
-    Seek(line, col);
-
     TSInputEdit edit;
-    edit.start_byte = GetOffset();
+    edit.start_byte = GetOffset(line, col);
     edit.start_point = { .row = static_cast<uint32_t>(line), .column = static_cast<uint32_t>(col) };
     edit.old_end_byte = edit.start_byte + rangeLength;
     edit.old_end_point = { .row = static_cast<uint32_t>(endLine), .column = static_cast<uint32_t>(endCol) };
 
-    after.resize(after.size() - rangeLength);
+    MoveGap(edit.start_byte);
+    gapEnd += rangeLength;
+    EnsureGap(contentLength);
+    Write(gapStart, content, contentLength);
+    gapStart += contentLength;
+    lines.Replace(edit.start_byte, edit.old_end_byte, content, contentLength);
 
-    InsertAtCursor(content, contentLength);
     edit.new_end_byte = edit.start_byte + contentLength;
-    edit.new_end_point = { .row = static_cast<uint32_t>(currentLine), .column = static_cast<uint32_t>(currentCol) };
+    edit.new_end_point = GetPoint(edit.new_end_byte);
 
     return edit;
 }
@@ -289,42 +376,58 @@ TSInputEdit GapBuffer::Edit(int line, int col, int endLine, int endCol, const ch
 
 uint32_t GapBuffer::GetOffset()
 {
-    return static_cast<uint32_t>(before.size());
+    return gapStart;
 }
 
-void GapBuffer::PrintContents()
+uint32_t GapBuffer::GetOffset(int line, int col) const
 {
-    for (auto c : before)
-    {
-        std::cout << c;
-    }
+    return lines.GetOffset(line, col);
+}
+
+TSPoint GapBuffer::GetPoint(uint32_t offset) const
+{
+    auto row = lines.LineOf(offset);
+    return TSPoint{ .row = row, .column = offset - lines.LineStart(row) };
+}
+
+uint32_t GapBuffer::Size() const
+{
+    return Capacity() - (gapEnd - gapStart);
+}
+
+uint32_t GapBuffer::LineCount() const
+{
+    return lines.LineCount();
+}
 
-    for (int i = 0; i < after.size(); i++)
+void GapBuffer::PrintContents()
+{
+    uint32_t offset = 0;
+    uint32_t length;
+    while (auto text = Read(offset, &length))
     {
-        int index = static_cast<int>(after.size()) - i - 1;
-        std::cout << after[index];
+        std::cout.write(text, length);
+        offset += length;
     }
 }
 
 // you gotta free this
  char* GapBuffer::Copy()
 {
-    auto storage = (char*)malloc(before.size() + after.size() + 1);
-    if (before.size() > 0)
-        memcpy(storage, &before[0], before.size());
+    auto size = Size();
+    auto storageCopy = (char*)malloc(size + 1);
 
-    if (after.size() > 0)
+    uint32_t offset = 0;
+    uint32_t length;
+    while (auto text = Read(offset, &length))
     {
-        for (int i = 0; i < after.size(); i++)
-        {
-            int index = static_cast<int>(after.size()) - i - 1;
-            storage[before.size() + i] = after[index];
-        }
+        memcpy(storageCopy + offset, text, length);
+        offset += length;
     }
 
-    storage[before.size() + after.size()] = '\0';
+    storageCopy[size] = '\0';
 
-    return storage;
+    return storageCopy;
 }
 
 buffer_view::buffer_view(int start, int end, const GapBuffer* buffer)
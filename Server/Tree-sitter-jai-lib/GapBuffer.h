@@ -1,45 +1,92 @@
 #pragma once
 
 #include <vector>
+#include <memory>
 #include <tree_sitter/api.h>
 #include <string_view>
+#include <optional>
 
 #include "Hash.h"
+#include "LineIndex.h"
+#include "MappedFile.h"
+#include "Identifiers.h"
 
 
 
 class GapBuffer
 {
     static constexpr char newline = '\n';
+    static constexpr uint32_t minimumGap = 4096;
+    static constexpr uint32_t chunkShift = 14;
+    static constexpr uint32_t chunkSize = 1 << chunkShift;
+    static constexpr uint32_t chunkMask = chunkSize - 1;
 
-    int currentLine = 0;
-    int currentCol = 0;
-
-public:
-    std::vector<char> before;
-    std::vector<char> after;
-
-private:
-    char Advance();
-    char Retreat();
-    void SeekLine(int line);
-    void CalculateCurrentColumnAtEdge();
+    struct Chunk
+    {
+        char bytes[chunkSize];
+    };
+
+    LineIndex lines;
+
+    // text is stored in order, with the gap sitting in [gapStart, gapEnd).
+    // the storage is split into fixed size chunks. a copy shares them, and an edit only copies the shared chunks it
+    // writes to, so the frozen copy that goes with every parse doesn't copy the text.
+    std::vector<std::shared_ptr<Chunk>> chunks;
+    uint32_t gapStart = 0;
+    uint32_t gapEnd = 0;
+
+    // a file loaded from disk reads straight out of its mapping, with no gap, until something edits it or it's unmapped.
+    // it's only meant to be held for the first parse, the os won't let the file be overwritten while it's mapped.
+    std::shared_ptr<const MappedFile> mapped;
+
+    void MoveGap(uint32_t offset);
+    void EnsureGap(uint32_t length);
+    void Promote();
+    uint32_t Capacity() const;
+
+    // runs within one chunk (or the mapping) starting at a storage index, the writable one unshares its chunk first.
+    const char* Run(uint32_t index, uint32_t* length) const;
+    char* WritableRun(uint32_t index, uint32_t* length);
+    void Write(uint32_t index, const char* content, uint32_t length);
+    void Move(uint32_t to, uint32_t from, uint32_t count);
+    void AddChunks(uint32_t bytes);
 
 public:
 
     GapBuffer();
+    GapBuffer(const GapBuffer& other);
+    GapBuffer(GapBuffer&& other) noexcept;
+    GapBuffer& operator=(const GapBuffer& other);
+    GapBuffer& operator=(GapBuffer&& other) noexcept;
+
     bool IsRewound();
     void Rewind();
-    inline char GetChar(int index) const;
+    inline char GetChar(int index) const
+    {
+        auto at = (uint32_t)index < gapStart ? (uint32_t)index : (uint32_t)index + (gapEnd - gapStart);
+        if (mapped)
+            return mapped->Data()[at];
+
+        return chunks[at >> chunkShift]->bytes[at & chunkMask];
+    }
+
+    // returns the contiguous run of text starting at offset, up to the gap, the end of a chunk or the end of the text.
+    const char* Read(uint32_t offset, uint32_t* bytesRead) const;
     void Seek(int line, int col);
     void InsertAtCursor(const char* content, int length);
     GapBuffer(const char* initialContent, int length);
+    GapBuffer(std::shared_ptr<const MappedFile> file);
+    bool IsMapped() const { return mapped != nullptr; }
+
+    // copies the text out of the mapping and lets go of it, so the file can be saved over or truncated.
+    void Unmap() { Promote(); }
 
     // this is slightly dangerous, because you can hold on to a string view for longer than it might be valid.
-    // mostly just use this for module parsing and initial tree creation.
-    std::string_view GetStringView(int start, int length);
-    std::string_view GetEntireStringView();
-    void GetRowCopy(int row, std::string& s);
+    // the text has to be one run, which a mapped file that hasn't been edited always is. a range that crosses
+    // from one chunk to the next, or past the gap, has no view and gets nullopt.
+    std::optional<std::string_view> GetStringView(int start, int length);
+    std::optional<std::string_view> GetEntireStringView();
+    void GetRowCopy(int row, std::string& s) const;
 
     /*
     The idea is that start and old_end describe the range of text that was removed,
@@ -48,6 +95,10 @@ public:
     */
     TSInputEdit Edit(int line, int col, int endLine, int endCol, const char* content, int contentLength, int rangeLength);
     uint32_t GetOffset();
+    uint32_t GetOffset(int line, int col) const;
+    TSPoint GetPoint(uint32_t offset) const;
+    uint32_t Size() const;
+    uint32_t LineCount() const;
     void PrintContents();
 
     // you gotta free this
@@ -69,56 +120,30 @@ struct buffer_view
 };
 
 
+// HashBytes over the utf-8 bytes. the c# side goes through HashString so paths hash the same on both sides.
 inline Hash StringHash(std::string_view string)
 {
-    uint64_t hash = 0xcbf29ce484222325ULL;
     Hash h;
+    h.value = HashBytes(string.data(), string.length());
 
 #if HASH_DEBUG_STRING
     h.debug_name = new char[string.length() + 1];
+    memcpy(h.debug_name, string.data(), string.length());
     h.debug_name[string.length()] = '\0';
 #endif
 
-
-    for (uint32_t i = 0; i < string.length(); i++)
-    {
-        hash = hash ^ string[i];
-        hash = hash * 0x00000100000001B3ULL;
-
-#if HASH_DEBUG_STRING
-        h.debug_name[i]= string[i];
-#endif
-    }
-
-    h.value = hash;
-
     return h;
 }
 
 inline Hash StringHash(buffer_view string)
 {
-    uint64_t hash = 0xcbf29ce484222325ULL;
-    Hash h;
-
-#if HASH_DEBUG_STRING
-    h.debug_name = new char[string.length + 1];
-    h.debug_name[string.length] = '\0';
-#endif
-
-    for (uint32_t i = 0; i < string.length; i++)
-    {
-        auto c = string.buffer->GetChar(string.start + i);
-        hash = hash ^ c;
-        hash = hash * 0x00000100000001B3ULL;
-
-#if HASH_DEBUG_STRING
-        h.debug_name[i] = c;
-#endif
-    }
-
-    h.value = hash;
+    // same as hashing a copy of it, only the rare view split by the gap actually gets copied.
+    uint32_t length;
+    auto run = string.buffer->Read(string.start, &length);
+    if (length >= string.length)
+        return StringHash(std::string_view(run, string.length));
 
-    return h;
+    return StringHash(string.Copy());
 }
 
 
@@ -127,14 +152,40 @@ inline Hash GetIdentifierHash(const TSNode& node, std::string_view code)
     auto start = ts_node_start_byte(node);
     auto end = ts_node_end_byte(node);
     auto length = end - start;
-    return StringHash(std::string_view(&code[start], length));
+    return IdentifierHash(std::string_view(&code[start], length));
 }
 
 inline Hash GetIdentifierHash(const TSNode& node, const GapBuffer* buffer)
 {
     auto start = ts_node_start_byte(node);
     auto end = ts_node_end_byte(node);
-    return StringHash(buffer_view(start, end, buffer));
+
+    // an identifier is nearly always in one run of the buffer, only one split by the gap gets copied out.
+    uint32_t length;
+    auto run = buffer->Read(start, &length);
+    if (length >= end - start)
+        return IdentifierHash(std::string_view(run, end - start));
+
+    return IdentifierHash(buffer_view(start, end, buffer).Copy());
+}
+
+// the same as GetIdentifierHash, for looking a reference up. it never adds the name to the identifier table.
+inline Hash FindIdentifierHash(const TSNode& node, const GapBuffer* buffer)
+{
+    auto start = ts_node_start_byte(node);
+    auto end = ts_node_end_byte(node);
+
+    uint32_t length;
+    auto run = buffer->Read(start, &length);
+    if (length >= end - start)
+        return FindIdentifierHash(std::string_view(run, end - start));
+
+    return FindIdentifierHash(buffer_view(start, end, buffer).Copy());
+}
+
+inline std::string_view GetInternedIdentifier(const TSNode& node, const GapBuffer* buffer)
+{
+    return g_identifiers.Name((uint32_t)GetIdentifierHash(node, buffer).value);
 }
 
 inline std::string_view GetIdentifier(const TSNode& node, std::string_view code)
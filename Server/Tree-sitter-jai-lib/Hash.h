@@ -1,7 +1,20 @@
 #pragma once
 
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+#include <intrin.h>
+#endif
+
 #define HASH_DEBUG_STRING 0
 
+// which kernel StringHash uses. everything keyed by a hash, the index cache and the c# side included, follows it.
+#define HASH_KERNEL_FNV1A 0
+#define HASH_KERNEL_WYHASH 1
+#define HASH_KERNEL HASH_KERNEL_WYHASH
+
 
 
 struct Hash
@@ -24,3 +37,115 @@ namespace std {
     };
 }
 
+
+// the old byte at a time hash, every byte waits on the multiply for the one before it.
+inline uint64_t Fnv1a(const void* data, size_t length)
+{
+    auto bytes = (const uint8_t*)data;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = hash ^ bytes[i];
+        hash = hash * 0x00000100000001B3ULL;
+    }
+
+    return hash;
+}
+
+inline void WyMultiply(uint64_t* a, uint64_t* b)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+    *a = _umul128(*a, *b, b);
+#elif defined(_MSC_VER) && defined(_M_ARM64)
+    auto low = *a * *b;
+    *b = __umulh(*a, *b);
+    *a = low;
+#else
+    auto product = (unsigned __int128)*a * *b;
+    *a = (uint64_t)product;
+    *b = (uint64_t)(product >> 64);
+#endif
+}
+
+inline uint64_t WyMix(uint64_t a, uint64_t b)
+{
+    WyMultiply(&a, &b);
+    return a ^ b;
+}
+
+inline uint64_t WyRead8(const uint8_t* p) { uint64_t v; memcpy(&v, p, 8); return v; }
+inline uint64_t WyRead4(const uint8_t* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+inline uint64_t WyRead3(const uint8_t* p, size_t k) { return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1]; }
+
+// wyhash (final 4) with seed 0 and the default secret, reading little endian. this exact definition keys the index cache,
+// so it can't change without bumping the cache version. 16 bytes a multiply, and paths longer than 48 bytes
+// run three independent lanes so the multiplies overlap.
+inline uint64_t WyHash(const void* data, size_t length)
+{
+    static constexpr uint64_t secret[4] = { 0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull };
+
+    auto p = (const uint8_t*)data;
+    uint64_t seed = WyMix(secret[0], secret[1]);
+    uint64_t a, b;
+
+    if (length <= 16)
+    {
+        if (length >= 4)
+        {
+            a = (WyRead4(p) << 32) | WyRead4(p + ((length >> 3) << 2));
+            b = (WyRead4(p + length - 4) << 32) | WyRead4(p + length - 4 - ((length >> 3) << 2));
+        }
+        else if (length > 0)
+        {
+            a = WyRead3(p, length);
+            b = 0;
+        }
+        else
+        {
+            a = b = 0;
+        }
+    }
+    else
+    {
+        size_t i = length;
+        if (i >= 48)
+        {
+            uint64_t seed1 = seed, seed2 = seed;
+            do
+            {
+                seed = WyMix(WyRead8(p) ^ secret[1], WyRead8(p + 8) ^ seed);
+                seed1 = WyMix(WyRead8(p + 16) ^ secret[2], WyRead8(p + 24) ^ seed1);
+                seed2 = WyMix(WyRead8(p + 32) ^ secret[3], WyRead8(p + 40) ^ seed2);
+                p += 48;
+                i -= 48;
+            } while (i >= 48);
+
+            seed ^= seed1 ^ seed2;
+        }
+
+        while (i > 16)
+        {
+            seed = WyMix(WyRead8(p) ^ secret[1], WyRead8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+
+        a = WyRead8(p + i - 16);
+        b = WyRead8(p + i - 8);
+    }
+
+    a ^= secret[1];
+    b ^= seed;
+    WyMultiply(&a, &b);
+    return WyMix(a ^ secret[0] ^ length, b ^ secret[1]);
+}
+
+inline uint64_t HashBytes(const void* data, size_t length)
+{
+#if HASH_KERNEL == HASH_KERNEL_WYHASH
+    return WyHash(data, length);
+#else
+    return Fnv1a(data, length);
+#endif
+}
@@ -1,6 +1,10 @@
 #include "Hashmap.h"
 #include <cassert>
+#include <cstring>
+#include <cstdlib>
+#include <bit>
 #include "stb_ds.h"
+#include "Arena.h"
 
 void Hashmap::Add(int key, ScopeHandle value)
 {
@@ -13,15 +17,21 @@ void Hashmap::Add(int key, ScopeHandle value)
 	hmput(map, key, value);
 }
 
+// a snapshot's map is read by any number of threads, and plain hmgeti hands the index back through the map's header.
 size_t Hashmap::GetIndex(int key)
 {
-	return hmgeti(map, key);
+	// a lookup in an empty one would allocate it.
+	if (map == nullptr)
+		return (size_t)-1;
+
+	ptrdiff_t index;
+	return hmgeti_ts(map, key, index);
 }
 
 ScopeHandle Hashmap::Get(int key)
 {
 	assert(Contains(key));
-	return hmget(map, key);
+	return map[GetIndex(key)].value;
 }
 
 size_t Hashmap::Size()
@@ -36,7 +46,7 @@ bool Hashmap::Remove(int key)
 
 bool Hashmap::Contains(int key)
 {
-	return hmgeti(map, key) >= 0;
+	return (ptrdiff_t)GetIndex(key) >= 0;
 }
 
 void Hashmap::Clear()
@@ -54,86 +64,355 @@ ScopeHandle Hashmap::operator[](size_t index)
 	return map[index].value;
 }
 
+Hashmap Hashmap::Copy() const
+{
+	Hashmap copy;
+	for (size_t i = 0; i < hmlenu(map); i++)
+	{
+		hmput(copy.map, map[i].key, map[i].value);
+	}
 
+	return copy;
+}
 
 
 
-void Scopemap::Add(Hash key, ScopeDeclaration value)
+
+
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define SCOPEMAP_SIMD 1
+#include <emmintrin.h>
+#else
+#define SCOPEMAP_SIMD 0
+#endif
+
+static constexpr uint32_t groupSize = 16;
+static constexpr uint32_t groupCapacity = 14; // keeps the table at most 7/8 full, so every probe finds an empty slot
+static constexpr uint8_t emptyControl = 0x80;
+static constexpr uint8_t deletedControl = 0xFE;
+
+// laid out as control bytes, slots, the flags column, keys, then declarations. the control bytes come first to stay 16 byte aligned,
+// and the flags column has room for a whole group past the capacity, so a 16 wide load from any entry stays inside the table.
+struct Scopemap::Table
 {
-	/*
-#if _DEBUG
-	for (int i = 0; i < Size(); i++)
+	uint32_t count;
+	uint32_t deleted;
+	uint32_t groupMask;
+	uint32_t capacity;
+
+	static size_t Bytes(uint32_t groups)
 	{
-		assert(map[i].value.index != value.index);
+		return sizeof(Table) + groups * groupSize * (sizeof(uint8_t) + sizeof(uint32_t) + sizeof(uint16_t))
+			+ groups * groupCapacity * (sizeof(Hash) + sizeof(ScopeDeclaration));
+	}
+
+	uint32_t Groups() const { return groupMask + 1; }
+	uint8_t* Control() { return (uint8_t*)(this + 1); }
+	uint32_t* Slots() { return (uint32_t*)(Control() + Groups() * groupSize); }
+	uint16_t* Flags() { return (uint16_t*)(Slots() + Groups() * groupSize); }
+	Hash* Keys() { return (Hash*)(Flags() + Groups() * groupSize); }
+	ScopeDeclaration* Declarations() { return (ScopeDeclaration*)(Keys() + Groups() * groupCapacity); }
+
+	// the entry at from, every column of it, goes over the one at to.
+	void Move(uint32_t from, uint32_t to)
+	{
+		Flags()[to] = Flags()[from];
+		Keys()[to] = Keys()[from];
+		Declarations()[to] = Declarations()[from];
 	}
+
+	void Empty()
+	{
+		count = 0;
+		deleted = 0;
+		memset(Control(), emptyControl, Groups() * groupSize);
+	}
+};
+
+// keys are interned identifier ids, small and sequential, so they need mixing before their bits are any use.
+static uint64_t MixKey(Hash key)
+{
+	return WyMix(key.value ^ 0x2d358dccaa6c78a5ull, 0x9e3779b97f4a7c15ull);
+}
+
+static uint32_t MatchControl(const uint8_t* group, uint8_t control)
+{
+#if SCOPEMAP_SIMD
+	auto bytes = _mm_loadu_si128((const __m128i*)group);
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)control)));
+#else
+	uint32_t mask = 0;
+	for (uint32_t i = 0; i < groupSize; i++)
+		mask |= (uint32_t)(group[i] == control) << i;
+	return mask;
 #endif
-	*/
-	idput(map, key, value);
+}
+
+// empty and deleted are the only controls with the top bit set.
+static uint32_t MatchFree(const uint8_t* group)
+{
+#if SCOPEMAP_SIMD
+	return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+	uint32_t mask = 0;
+	for (uint32_t i = 0; i < groupSize; i++)
+		mask |= (uint32_t)(group[i] >> 7) << i;
+	return mask;
+#endif
+}
+
+int Scopemap::FindSlot(Hash key) const
+{
+	if (table == nullptr)
+		return -1;
+
+	auto hash = MixKey(key);
+	auto tag = (uint8_t)(hash & 0x7F);
+	auto group = (uint32_t)(hash >> 7) & table->groupMask;
+	auto control = table->Control();
+	auto slots = table->Slots();
+	auto keys = table->Keys();
+
+	// triangular steps over a power of two group count visit every group.
+	for (uint32_t step = 1; ; step++)
+	{
+		auto groupControl = control + group * groupSize;
+		for (auto matches = MatchControl(groupControl, tag); matches != 0; matches &= matches - 1)
+		{
+			auto slot = group * groupSize + std::countr_zero(matches);
+			if (keys[slots[slot]] == key)
+				return (int)slot;
+		}
+
+		// the key would have gone in that empty slot if it were here.
+		if (MatchControl(groupControl, emptyControl) != 0)
+			return -1;
+
+		group = (group + step) & table->groupMask;
+	}
+}
+
+void Scopemap::InsertSlot(uint64_t hash, uint32_t index)
+{
+	auto group = (uint32_t)(hash >> 7) & table->groupMask;
+	auto control = table->Control();
+
+	for (uint32_t step = 1; ; step++)
+	{
+		auto open = MatchFree(control + group * groupSize);
+		if (open != 0)
+		{
+			auto slot = group * groupSize + std::countr_zero(open);
+			if (control[slot] == deletedControl)
+				table->deleted--;
+
+			control[slot] = (uint8_t)(hash & 0x7F);
+			table->Slots()[slot] = index;
+			return;
+		}
+
+		group = (group + step) & table->groupMask;
+	}
+}
+
+Scopemap::Table* Scopemap::AllocateTable(uint32_t groups)
+{
+	auto bytes = Table::Bytes(groups);
+	Table* allocated;
+	if (arena != nullptr)
+	{
+		allocated = (Table*)arena->Allocate(bytes, groupSize);
+	}
+	else
+	{
+		allocated = (Table*)malloc(bytes);
+		g_allocationStats.heap.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	allocated->groupMask = groups - 1;
+	allocated->capacity = groups * groupCapacity;
+	allocated->Empty();
+	return allocated;
+}
+
+// doubles, unless most of what's in the way is deleted slots, then it just clears those out at the same size.
+void Scopemap::Grow()
+{
+	uint32_t groups = 1;
+	if (table != nullptr)
+	{
+		groups = table->Groups();
+		if (table->deleted < table->count)
+			groups *= 2;
+	}
+
+	auto old = table;
+	table = AllocateTable(groups);
+	if (old == nullptr)
+		return;
+
+	auto keys = table->Keys();
+	memcpy(table->Flags(), old->Flags(), old->count * sizeof(uint16_t));
+	memcpy(keys, old->Keys(), old->count * sizeof(Hash));
+	memcpy(table->Declarations(), old->Declarations(), old->count * sizeof(ScopeDeclaration));
+	table->count = old->count;
+	for (uint32_t i = 0; i < table->count; i++)
+		InsertSlot(MixKey(keys[i]), i);
+
+	// the old table stays in the arena until it's reset.
+	if (arena == nullptr)
+		free(old);
+}
+
+void Scopemap::Add(Hash key, ScopeDeclaration value)
+{
+	// adding a key that's already there replaces its declaration, like stb_ds did.
+	if (auto slot = FindSlot(key); slot >= 0)
+	{
+		Update(table->Slots()[slot], value);
+		return;
+	}
+
+	if (table == nullptr || table->count + table->deleted >= table->capacity)
+		Grow();
+
+	auto index = table->count++;
+	table->Keys()[index] = key;
+	Update(index, value);
+	InsertSlot(MixKey(key), index);
 }
 
 int Scopemap::GetIndex(Hash key)
 {
-	ptrdiff_t temp;
-	return (int)idgeti_ts(map, key, temp);
+	auto slot = FindSlot(key);
+	return slot >= 0 ? (int)table->Slots()[slot] : -1;
 }
 
 ScopeDeclaration Scopemap::Get(Hash key)
 {
 	assert(Contains(key));
-	ptrdiff_t temp;
-	return idget_ts(map, key, temp);
+	return table->Declarations()[GetIndex(key)];
 }
 
 size_t Scopemap::Size() const 
 {
-	if (map == nullptr)
+	if (table == nullptr)
 		return 0;
 
-	return idlenu(map);
+	return table->count;
 }
 
+// the last entry moves into the hole, the same as stb_ds's delete.
 bool Scopemap::Remove(Hash key)
 {
-	return iddel(map, key);
+	auto slot = FindSlot(key);
+	if (slot < 0)
+		return false;
+
+	auto slots = table->Slots();
+	auto index = slots[slot];
+	table->Control()[slot] = deletedControl;
+	table->deleted++;
+
+	auto last = --table->count;
+	if (index != last)
+	{
+		table->Move(last, index);
+		slots[FindSlot(table->Keys()[index])] = index;
+	}
+
+	return true;
 }
 
 bool Scopemap::Contains(Hash key)
 {
-	ptrdiff_t temp;
-	return idgeti_ts(map, key, temp) >= 0;
+	return FindSlot(key) >= 0;
 }
 
 void Scopemap::Clear()
 {
-	idfree(map);
+	if (arena != nullptr)
+	{
+		if (table != nullptr)
+			table->Empty();
+
+		return;
+	}
+
+	free(table);
+	table = nullptr;
 }
 
-Scopemap::kvp* Scopemap::Data()
+void Scopemap::Release()
 {
-	return map;
+	if (arena == nullptr)
+		free(table);
+
+	table = nullptr;
 }
 
-ScopeDeclaration Scopemap::operator[](size_t index) const
+const Hash* Scopemap::Keys() const
 {
-	return map[index].value;
+	return table ? table->Keys() : nullptr;
 }
 
-void Scopemap::Update(size_t index, ScopeDeclaration value)
+ScopeDeclaration* Scopemap::Declarations()
 {
-	map[index].value = value;
+	return table ? table->Declarations() : nullptr;
 }
 
+ScopeDeclaration Scopemap::operator[](size_t index) const
+{
+	return table->Declarations()[index];
+}
 
+void Scopemap::Update(size_t index, ScopeDeclaration value)
+{
+	table->Declarations()[index] = value;
+	table->Flags()[index] = (uint16_t)value.flags;
+}
 
+void Scopemap::SetFlags(size_t index, DeclarationFlags flags)
+{
+	table->Declarations()[index].flags = flags;
+	table->Flags()[index] = (uint16_t)flags;
+}
 
+// a bit for each of the 16 entries from the first one, set when (flags & mask) == value. entries past the end never match.
+uint32_t Scopemap::MatchFlags(size_t first, DeclarationFlags mask, DeclarationFlags value) const
+{
+	if (table == nullptr || first >= table->count)
+		return 0;
 
+	auto count = table->count - (uint32_t)first;
+	auto valid = count >= groupSize ? 0xFFFFu : (1u << count) - 1;
 
+	auto flags = table->Flags() + first;
 
+#if SCOPEMAP_SIMD
+	auto maskBits = _mm_set1_epi16((short)mask);
+	auto valueBits = _mm_set1_epi16((short)value);
+	auto low = _mm_cmpeq_epi16(_mm_and_si128(_mm_loadu_si128((const __m128i*)flags), maskBits), valueBits);
+	auto high = _mm_cmpeq_epi16(_mm_and_si128(_mm_loadu_si128((const __m128i*)(flags + 8)), maskBits), valueBits);
+	return (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(low, high)) & valid;
+#else
+	uint32_t matches = 0;
+	for (uint32_t i = 0; i < groupSize && i < count; i++)
+		matches |= (uint32_t)((flags[i] & mask) == value) << i;
 
+	return matches;
+#endif
+}
 
+// the layout doesn't depend on where it is, so a copy is the one allocation copied.
+Scopemap Scopemap::Copy(Arena* arena) const
+{
+	Scopemap copy(arena);
+	if (table != nullptr)
+	{
+		copy.table = copy.AllocateTable(table->Groups());
+		memcpy(copy.table, table, Table::Bytes(table->Groups()));
+	}
 
-
-
-
-
-
+	return copy;
+}
@@ -21,6 +21,7 @@ public:
 	void Clear();
 	kvp* Data();
 	ScopeHandle operator[](size_t);
+	Hashmap Copy() const;
 };
 
 
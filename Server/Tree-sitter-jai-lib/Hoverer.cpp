@@ -1,5 +1,6 @@
 #include "TreeSitterJai.h"
 #include "FileScope.h"
+#include "AnalysisScheduler.h"
 
 static bool IsMemberAccess(TSSymbol symbol)
 {
@@ -14,13 +15,13 @@ const TypeKing* GetType(TypeHandle handle)
 	if (handle == TypeHandle::Null())
 		return nullptr;
 
-	return &g_fileScopeByIndex.Read(handle.fileIndex)->types[handle.index];
+	return &GetFileScope(handle.fileIndex)->types[handle.index];
 }
 
 int GetDeclarationForNodeFromScope(TSNode node, FileScope* fileScope, Scope* scope, FileScope** outFile, Scope** outScope)
 {
 	// search scopes going up for entries, if they're data scopes. if they're imperative scopes then declarations have to be in order.
-	auto identifierHash = GetIdentifierHash(node, fileScope->buffer);
+	auto identifierHash = FindIdentifierHash(node, fileScope->buffer);
 	while (scope != nullptr)
 	{
 		auto declIndex = scope->GetIndex(identifierHash);
@@ -32,7 +33,7 @@ int GetDeclarationForNodeFromScope(TSNode node, FileScope* fileScope, Scope* sco
 				auto decl = scope->GetDeclFromIndex(declIndex);
 				auto constant = decl->HasFlags(DeclarationFlags::Constant);
 
-				auto definitionStart = decl->startByte;
+				auto definitionStart = fileScope->DeclarationStart(scope, *decl);
 				auto identifierStart = ts_node_start_byte(node);
 				if (constant || (identifierStart >= definitionStart))
 				{
@@ -89,21 +90,10 @@ int EvaluateMemberAccess(TSNode node, FileScope* fileScope, Scope* scope, Scope*
 	if (!lhsDecl)
 		return -1;
 
-	if ( !lhsDecl->HasFlags(DeclarationFlags::Evaluated) )
-	{
-		// so we need to get the file scope for this declaration as well
-
-		auto rhsNode = ConstructRhsFromDecl(*lhsDecl, (*outFile)->currentTree);
-		if (auto typeHandle = (*outFile)->EvaluateNodeExpressionType(rhsNode, *outScope))
-		{
-			lhsDecl->type = *typeHandle;
-			lhsDecl->flags = lhsDecl->flags | DeclarationFlags::Evaluated;
-		}
-		else
-		{
-			return -1;
-		}
-	}
+	// the declaration belongs to the file it was found in, that's where its rhs is.
+	auto lhsType = (*outFile)->InferDeclarationType(*outScope, declIndex);
+	if (!lhsType)
+		return -1;
 
 
 
@@ -111,12 +101,12 @@ int EvaluateMemberAccess(TSNode node, FileScope* fileScope, Scope* scope, Scope*
 		return declIndex;
 
 	auto rhs = ts_node_named_child(node, 1);
-	auto rhsHash = GetIdentifierHash(rhs, fileScope->buffer);
+	auto rhsHash = FindIdentifierHash(rhs, fileScope->buffer);
 
 	// search for rhs in the members of the LHS type
 
-	auto file = g_fileScopeByIndex.Read(lhsDecl->type.fileIndex);
-	auto members = file->GetScope(lhsDecl->type.scope);
+	auto file = GetFileScope(lhsType->fileIndex);
+	auto members = file->GetScope(lhsType->scope);
 	if (!members->checked)
 	{
 		file->CheckScope(members);
@@ -160,22 +150,19 @@ std::optional<TypeHandle> EvaluateMemberAccessType(TSNode node, FileScope* fileS
 		return lhsType;
 
 	auto rhs = ts_node_named_child(node, 1);
-	auto rhsHash = GetIdentifierHash(rhs, fileScope->buffer);
+	auto rhsHash = FindIdentifierHash(rhs, fileScope->buffer);
 	// search for rhs in the members of the LHS type
 
 	{
-		auto file = g_fileScopeByIndex.Read(lhsType->fileIndex);
+		auto file = GetFileScope(lhsType->fileIndex);
 		auto members = file->GetScope(lhsType->scope);
 		if (!members->checked)
 		{
 			file->CheckScope(members);
 		}
 
-		if (auto rhsDecl = members->TryGet(rhsHash))
-		{
-			if(rhsDecl->HasFlags(DeclarationFlags::Evaluated))
-				return rhsDecl->type;
-		}
+		if (auto rhsIndex = members->GetIndex(rhsHash); rhsIndex >= 0)
+			return file->InferDeclarationType(members, rhsIndex);
 	}
 
 	return std::nullopt;
@@ -231,17 +218,8 @@ int GetDeclarationForNode(TSNode node, FileScope* fileScope, Scope* startingScop
 	}
 
 	// @TODO make sure this isn't broken
-	// this should probably? always be evalualted because this only runs in the tokens code.
-	auto result = GetDeclarationForNodeFromScope(node, fileScope, startingScope, outFile, outScope);
-#if _DEBUG
-	if (result >= 0)
-	{
-		auto decl = (*outScope)->GetDeclFromIndex(result);
-		assert(decl->HasFlags(DeclarationFlags::Evaluated));
-	}
-#endif
-
-	return result;
+	// the declaration's type is only worked out when someone asks for it, it can still be unevaluated here.
+	return GetDeclarationForNodeFromScope(node, fileScope, startingScope, outFile, outScope);
 	/*
 	auto declIndex = GetDeclarationForNodeFromScope(node, fileScope, startingScope, outFile, outScope);
 	if (declIndex >= 0)
@@ -316,9 +294,13 @@ export_jai_lsp const char* GetLine(uint64_t hashValue, int row)
 	thread_local std::string s;
 	s.clear();
 
+	// the text hover and signature help answered from, the live buffer may be in the middle of an edit.
 	auto documentName = Hash{ .value = hashValue };
-	auto buffer = g_buffers.Read(documentName).value();
-	buffer->GetRowCopy(row, s);
+	auto snapshot = g_analysis.LatestSnapshot(documentName);
+	if (!snapshot)
+		return s.c_str();
+
+	snapshot->text->GetRowCopy(row, s);
 
 	return s.c_str();
 }
@@ -336,10 +318,20 @@ export_jai_lsp void GetSignature(uint64_t hashValue, int row, int col, const cha
 
 	auto documentName = Hash{ .value = hashValue };
 
-	auto tree = ts_tree_copy(g_trees.Read(documentName).value());
+	// the signature strings are in the snapshot's analysis, this keeps them alive until the caller has copied them.
+	thread_local SnapshotRecord snapshot;
+	snapshot = g_analysis.LatestSnapshot(documentName);
+	if (!snapshot)
+	{
+		*outSignature = nullptr;
+		return;
+	}
+
+	SnapshotPin pin(snapshot.get());
+	auto tree = snapshot->tree.get();
 	auto root = ts_tree_root_node(tree);
-	auto buffer = g_buffers.Read(documentName).value();
-	auto fileScope = g_fileScopes.Read(documentName).value();
+	auto buffer = snapshot->text.get();
+	auto fileScope = snapshot->analysis.get();
 
 	auto point = TSPoint{ static_cast<uint32_t>(row), static_cast<uint32_t>(col) };
 	auto node = ts_node_named_descendant_for_point_range(root, point, point);
@@ -355,7 +347,6 @@ export_jai_lsp void GetSignature(uint64_t hashValue, int row, int col, const cha
 		if (ts_node_is_null(node))
 		{
 			*outSignature = nullptr;
-			ts_tree_delete(tree);
 			return;
 		}
 	}
@@ -366,12 +357,12 @@ export_jai_lsp void GetSignature(uint64_t hashValue, int row, int col, const cha
 	if (auto type = GetTypeForNode(node, fileScope))
 	{
 		auto king = GetType(*type);
-		strings.push_back(king->name.c_str());
+		strings.push_back(king->name.data());
 
 		*outParameterCount = (int)king->parameters.size();
 		for (auto& str : king->parameters)
 		{
-			strings.push_back(str.c_str());
+			strings.push_back(str.data());
 		}
 
 		*outSignature = strings.data();
@@ -424,15 +415,12 @@ export_jai_lsp void GetSignature(uint64_t hashValue, int row, int col, const cha
 		*outErrors = errors.data();
 		*outActiveParameter = param;
 	}
-
-
-	ts_tree_delete(tree);
 }
 
 
 static void GetAttributeText(std::string& dst, TypeHandle handle)
 {
-	auto file = g_fileScopeByIndex.Read(handle.fileIndex);
+	auto file = GetFileScope(handle.fileIndex);
 	auto king = &file->types[handle.index];
 	dst = "";
 
@@ -456,10 +444,15 @@ export_jai_lsp const char* Hover(uint64_t hashValue, int row, int col)
 	static std::string hoverText;
 	auto documentName = Hash{ .value = hashValue };
 
-	auto tree = ts_tree_copy(g_trees.Read(documentName).value());
+	auto snapshot = g_analysis.LatestSnapshot(documentName);
+	if (!snapshot)
+		return nullptr;
+
+	SnapshotPin pin(snapshot.get());
+	auto tree = snapshot->tree.get();
 	auto root = ts_tree_root_node(tree);
-	auto buffer = g_buffers.Read(documentName).value();
-	auto fileScope = g_fileScopes.Read(documentName).value();
+	auto buffer = snapshot->text.get();
+	auto fileScope = snapshot->analysis.get();
 
 	auto point = TSPoint{ static_cast<uint32_t>(row), static_cast<uint32_t>(col) };
 	auto node = ts_node_named_descendant_for_point_range(root, point, point);
@@ -471,12 +464,9 @@ export_jai_lsp const char* Hover(uint64_t hashValue, int row, int col)
 
 	if (auto type = GetTypeForNode(node, fileScope))
 	{
-		ts_tree_delete(tree);
 		GetAttributeText(hoverText, *type);
 		return hoverText.c_str();
 	}
 
-
-	ts_tree_delete(tree);
 	return nullptr;
 }
@@ -0,0 +1,121 @@
+#include "Identifiers.h"
+#include "TreeSitterJai.h"
+
+#include <mutex>
+#include <cstring>
+
+
+// never freed, the scopes of every file hold its ids until the process goes away.
+IdentifierTable& g_identifiers = *new IdentifierTable();
+
+uint32_t IdentifierTable::Intern(std::string_view name)
+{
+	// the high half picks the shard, the map buckets by the low one.
+	auto hash = HashBytes(name.data(), name.size());
+	auto& shard = shards[(hash >> 32) % shardCount];
+	shard.lookups.fetch_add(1, std::memory_order_relaxed);
+
+	{
+		std::shared_lock lock(shard.mutex);
+		if (auto it = shard.ids.find(name); it != shard.ids.end())
+		{
+			shard.hits.fetch_add(1, std::memory_order_relaxed);
+			return it->second;
+		}
+	}
+
+	std::unique_lock lock(shard.mutex);
+	if (auto it = shard.ids.find(name); it != shard.ids.end())
+	{
+		shard.hits.fetch_add(1, std::memory_order_relaxed);
+		return it->second;
+	}
+
+	auto stored = Store(shard, name);
+
+	uint32_t id;
+	{
+		std::unique_lock namesLock(namesMutex);
+		id = (uint32_t)names.size();
+		names.push_back(stored);
+	}
+
+	shard.ids.emplace(stored, id);
+	return id;
+}
+
+uint32_t IdentifierTable::Find(std::string_view name)
+{
+	auto hash = HashBytes(name.data(), name.size());
+	auto& shard = shards[(hash >> 32) % shardCount];
+	shard.lookups.fetch_add(1, std::memory_order_relaxed);
+
+	std::shared_lock lock(shard.mutex);
+	if (auto it = shard.ids.find(name); it != shard.ids.end())
+	{
+		shard.hits.fetch_add(1, std::memory_order_relaxed);
+		return it->second;
+	}
+
+	return none;
+}
+
+std::string_view IdentifierTable::Name(uint32_t id)
+{
+	std::shared_lock lock(namesMutex);
+	return id < names.size() ? names[id] : std::string_view();
+}
+
+// names are packed into blocks that never move, so the views into them stay good.
+// each one is followed by a zero, a name can go to c# as it is.
+std::string_view IdentifierTable::Store(Shard& shard, std::string_view name)
+{
+	if (name.size() > blockSize / 4)
+	{
+		// a huge name gets a block of its own, and doesn't waste what's left of the current one.
+		shard.blocks.insert(shard.blocks.begin(), std::make_unique<char[]>(name.size() + 1));
+		memcpy(shard.blocks.front().get(), name.data(), name.size());
+		shard.blocks.front()[name.size()] = '\0';
+		shard.bytes += name.size() + 1;
+		return std::string_view(shard.blocks.front().get(), name.size());
+	}
+
+	if (shard.blockUsed + name.size() + 1 > blockSize)
+	{
+		shard.blocks.push_back(std::make_unique<char[]>(blockSize));
+		shard.blockUsed = 0;
+		shard.bytes += blockSize;
+	}
+
+	auto stored = shard.blocks.back().get() + shard.blockUsed;
+	memcpy(stored, name.data(), name.size());
+	stored[name.size()] = '\0';
+	shard.blockUsed += name.size() + 1;
+	return std::string_view(stored, name.size());
+}
+
+
+// bytes is the names themselves plus a rough count of what the tables around them take.
+export_jai_lsp void GetIdentifierStats(uint64_t* outCount, uint64_t* outBytes, uint64_t* outLookups, uint64_t* outHits)
+{
+	uint64_t bytes = 0, lookups = 0, hits = 0;
+	for (auto& shard : g_identifiers.shards)
+	{
+		std::shared_lock lock(shard.mutex);
+		bytes += shard.bytes;
+		bytes += shard.ids.bucket_count() * sizeof(void*);
+		bytes += shard.ids.size() * (sizeof(std::string_view) + sizeof(uint32_t) + 2 * sizeof(void*));
+		lookups += shard.lookups;
+		hits += shard.hits;
+	}
+
+	{
+		std::shared_lock lock(g_identifiers.namesMutex);
+		*outCount = g_identifiers.names.size() - 1; // not counting none
+		bytes += g_identifiers.names.capacity() * sizeof(std::string_view);
+	}
+
+	*outBytes = bytes;
+	*outLookups = lookups;
+	*outHits = hits;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <shared_mutex>
+#include <atomic>
+#include <stdint.h>
+
+#include "Hash.h"
+
+
+// every identifier gets a small dense id the first time it's seen, the same one in every file. ids start at 1, 0 is no identifier.
+// scopes are keyed by the id, a name is read out of the buffer once and every scope it's looked up in after that compares integers.
+// ids only last as long as the process, anything written to disk has to keep the name.
+struct IdentifierTable
+{
+	static constexpr size_t shardCount = 64;
+	static constexpr size_t blockSize = 64 * 1024;
+
+	struct NameHasher
+	{
+		size_t operator()(std::string_view name) const { return (size_t)HashBytes(name.data(), name.size()); }
+	};
+
+	// names are spread over shards by their hash so loads on different threads rarely wait on each other.
+	struct alignas(64) Shard
+	{
+		std::shared_mutex mutex;
+		std::unordered_map<std::string_view, uint32_t, NameHasher> ids; // the keys point into blocks
+		std::vector<std::unique_ptr<char[]>> blocks;
+		size_t blockUsed = blockSize;
+		size_t bytes = 0;
+
+		std::atomic<uint64_t> lookups = 0;
+		std::atomic<uint64_t> hits = 0;
+	};
+
+	Shard shards[shardCount];
+
+	static constexpr uint32_t none = 0;
+
+	std::shared_mutex namesMutex;
+	std::vector<std::string_view> names = { std::string_view() }; // id -> name
+
+	uint32_t Intern(std::string_view name);
+	uint32_t Find(std::string_view name); // none if the name was never interned
+	std::string_view Name(uint32_t id);
+
+private:
+	std::string_view Store(Shard& shard, std::string_view name);
+};
+
+extern IdentifierTable& g_identifiers;
+
+// the key an identifier has in a scope.
+inline Hash IdentifierHash(std::string_view name)
+{
+	return Hash{ .value = g_identifiers.Intern(name) };
+}
+
+// the key to look a name up with. a name that was never interned isn't declared anywhere, so it isn't added just to miss.
+inline Hash FindIdentifierHash(std::string_view name)
+{
+	return Hash{ .value = g_identifiers.Find(name) };
+}
+
+// the table's own copy of a name, it lives as long as the process and is zero terminated.
+inline std::string_view InternedName(std::string_view name)
+{
+	return g_identifiers.Name(g_identifiers.Intern(name));
+}
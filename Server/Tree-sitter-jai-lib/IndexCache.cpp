@@ -0,0 +1,647 @@
+#include "IndexCache.h"
+#include "FileScope.h"
+
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+
+
+IndexCache g_indexCache;
+
+struct Header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entryCount;
+	uint32_t reserved;
+};
+
+// file indices are handed out in load order, so they're different every run. a saved handle has the file's slot
+// in the entry's file table instead, and gets the index back when it's restored.
+static constexpr uint32_t s_noFile = UINT32_MAX;
+
+struct Writer
+{
+	std::string bytes;
+
+	template<typename T>
+	void Write(const T& value)
+	{
+		bytes.append((const char*)&value, sizeof(T));
+	}
+
+	void WriteString(std::string_view string)
+	{
+		Write((uint32_t)string.size());
+		bytes.append(string);
+	}
+};
+
+// a bad or short entry reads as zeros from where it went wrong, and ok says so.
+struct Reader
+{
+	const char* at;
+	const char* end;
+	bool ok = true;
+
+	template<typename T>
+	T Read()
+	{
+		T value{};
+		if ((size_t)(end - at) < sizeof(T))
+		{
+			ok = false;
+			return value;
+		}
+
+		memcpy(&value, at, sizeof(T));
+		at += sizeof(T);
+		return value;
+	}
+
+	std::string ReadString()
+	{
+		auto length = Read<uint32_t>();
+		if (!ok || (size_t)(end - at) < length)
+		{
+			ok = false;
+			return {};
+		}
+
+		std::string string(at, length);
+		at += length;
+		return string;
+	}
+
+	// a count that can't possibly fit in what's left is a corrupt entry, not a reason to allocate gigabytes.
+	uint32_t ReadCount(size_t minimumSize)
+	{
+		auto count = Read<uint32_t>();
+		if ((size_t)(end - at) < count * minimumSize)
+		{
+			ok = false;
+			return 0;
+		}
+
+		return count;
+	}
+};
+
+static bool Stat(const std::string& path, int64_t* outMtime, uint64_t* outSize)
+{
+	std::error_code error;
+	auto time = std::filesystem::last_write_time(path, error);
+	if (error)
+		return false;
+
+	auto size = std::filesystem::file_size(path, error);
+	if (error)
+		return false;
+
+	*outMtime = (int64_t)time.time_since_epoch().count();
+	*outSize = (uint64_t)size;
+	return true;
+}
+
+static bool SameText(const GapBuffer* text, std::string_view other)
+{
+	if (text->Size() != other.size())
+		return false;
+
+	uint32_t offset = 0;
+	while (offset < other.size())
+	{
+		uint32_t length;
+		auto chunk = text->Read(offset, &length);
+		if (length == 0 || memcmp(chunk, other.data() + offset, length) != 0)
+			return false;
+
+		offset += length;
+	}
+
+	return true;
+}
+
+static uint64_t HashText(const GapBuffer* text)
+{
+	std::string copy;
+	copy.reserve(text->Size());
+
+	uint32_t offset = 0;
+	while (offset < text->Size())
+	{
+		uint32_t length;
+		auto chunk = text->Read(offset, &length);
+		if (length == 0)
+			break;
+
+		copy.append(chunk, length);
+		offset += length;
+	}
+
+	return StringHash(copy).value;
+}
+
+
+bool IndexCache::Open(const std::string& cachePath)
+{
+	std::unique_lock lock(mutex);
+	path = cachePath;
+	entries.clear();
+
+	if (!mapping.Open(path))
+		return false;
+
+	Reader reader{ mapping.Data(), mapping.Data() + mapping.Size() };
+	auto header = reader.Read<Header>();
+	if (!reader.ok || header.magic != magic || header.version != version)
+	{
+		// written by some other version, it gets replaced on the next save.
+		mapping.Close();
+		return false;
+	}
+
+	for (uint32_t i = 0; i < header.entryCount; i++)
+	{
+		auto entry = reader.Read<Entry>();
+		if (!reader.ok || entry.offset > mapping.Size() || entry.length > mapping.Size() - entry.offset)
+		{
+			entries.clear();
+			mapping.Close();
+			return false;
+		}
+
+		entries[entry.pathHash] = entry;
+	}
+
+	return true;
+}
+
+
+struct FileSlot
+{
+	Hash documentHash;
+	uint64_t contentHash;
+	std::string path;
+};
+
+static void WriteHandle(Writer& writer, TypeHandle handle, const std::function<uint32_t(uint32_t)>& slotOf)
+{
+	writer.Write(handle == TypeHandle::Null() ? s_noFile : slotOf(handle.fileIndex));
+	writer.Write(handle.index);
+	writer.Write(handle.scope.index);
+	writer.Write(handle.attributes);
+}
+
+static TypeHandle ReadHandle(Reader& reader, const std::vector<uint32_t>& fileIndices)
+{
+	auto slot = reader.Read<uint32_t>();
+	TypeHandle handle;
+	handle.index = reader.Read<uint32_t>();
+	handle.scope.index = reader.Read<uint32_t>();
+	handle.attributes = reader.Read<uint16_t>();
+
+	if (slot == s_noFile)
+		return TypeHandle::Null();
+
+	if (slot >= fileIndices.size())
+	{
+		reader.ok = false;
+		return TypeHandle::Null();
+	}
+
+	handle.fileIndex = fileIndices[slot];
+	return handle;
+}
+
+// the file table goes first, so an entry can be thrown out for a changed dependency before anything else is read.
+// false if the file has types from a file that isn't being saved.
+static bool WriteFile(Writer& writer, FileScope* fileScope, const std::unordered_map<uint32_t, FileSlot>& saving)
+{
+	std::vector<FileSlot> slots;
+	std::unordered_map<uint32_t, uint32_t> fileToSlot;
+	bool complete = true;
+
+	auto slotOf = [&](uint32_t fileIndex) -> uint32_t
+	{
+		if (auto it = fileToSlot.find(fileIndex); it != fileToSlot.end())
+			return it->second;
+
+		FileSlot slot;
+		if (auto saved = saving.find(fileIndex); saved != saving.end())
+		{
+			slot = saved->second;
+		}
+		else if (fileIndex == 0)
+		{
+			slot = { StringHash("builtin"), 0, "" }; // made by Init, it's the same every run
+		}
+		else
+		{
+			complete = false;
+		}
+
+		auto index = (uint32_t)slots.size();
+		slots.push_back(slot);
+		fileToSlot[fileIndex] = index;
+		return index;
+	};
+
+	slotOf(fileScope->fileIndex);
+
+	Writer body;
+	body.Write(fileScope->file.index);
+
+	body.Write((uint32_t)fileScope->loads.size());
+	for (auto load : fileScope->loads)
+	{
+		auto loaded = GetDocument(load);
+		body.WriteString(loaded ? loaded->path : "");
+	}
+
+	std::vector<std::string> imports;
+	for (auto import : fileScope->imports)
+	{
+		if (auto mod = g_modules.Read(import))
+			imports.push_back(mod.value()->name);
+	}
+
+	body.Write((uint32_t)imports.size());
+	for (auto& import : imports)
+	{
+		body.WriteString(import);
+	}
+
+	body.Write((uint32_t)fileScope->types.size());
+	for (size_t t = 0; t < fileScope->types.size(); t++)
+	{
+		auto& type = fileScope->types[t];
+		body.WriteString(type.name);
+		body.Write((uint32_t)type.parameters.size());
+		for (auto& parameter : type.parameters)
+		{
+			body.WriteString(parameter);
+		}
+
+		body.Write((uint32_t)type.returnTypes.size());
+		for (auto returnType : type.returnTypes)
+		{
+			WriteHandle(body, returnType, slotOf);
+		}
+	}
+
+	body.Write((uint32_t)fileScope->scopeKings.size());
+	for (size_t s = 0; s < fileScope->scopeKings.size(); s++)
+	{
+		auto& scope = fileScope->scopeKings[s];
+		WriteHandle(body, scope.associatedType, slotOf);
+		body.Write((uint8_t)scope.imperative);
+		body.Write((uint8_t)scope.exportingIn);
+		body.Write((uint8_t)scope.exportingOut);
+		body.Write(scope.parent.index);
+
+		// nothing outside the file can see into a function body, and inside it gets parsed for real.
+		auto declCount = scope.imperative ? 0 : (uint32_t)scope.declarations.Size();
+		body.Write(declCount);
+		for (uint32_t i = 0; i < declCount; i++)
+		{
+			auto type = fileScope->InferDeclarationType(&scope, (int)i);
+			auto& decl = scope.declarations.Declarations()[i];
+			auto key = scope.declarations.Keys()[i];
+			auto flags = decl.flags;
+			if (type)
+				flags = flags | DeclarationFlags::Evaluated;
+
+			// an unevaluated declaration points at its node, there won't be a tree to find it in.
+			body.WriteString(std::string(g_identifiers.Name((uint32_t)key.value)));
+			body.Write(fileScope->DeclarationStart(&scope, decl));
+			body.Write(decl.GetLength());
+			body.Write(decl.GetRHSOffset());
+			body.Write((uint16_t)flags);
+			WriteHandle(body, type ? *type : TypeHandle::Null(), slotOf);
+		}
+	}
+
+	if (!complete)
+		return false;
+
+	writer.Write((uint32_t)slots.size());
+	for (auto& slot : slots)
+	{
+		writer.Write(slot.documentHash.value);
+		writer.Write(slot.contentHash);
+		writer.WriteString(slot.path);
+	}
+
+	writer.bytes.append(body.bytes);
+	return true;
+}
+
+int IndexCache::Save()
+{
+	auto fileCount = g_fileScopeByIndex.size();
+
+	// files nobody has asked about yet have their scopes but haven't been checked.
+	for (size_t i = 0; i < fileCount; i++)
+	{
+		auto fileScope = g_fileScopeByIndex.Read(i);
+		if (fileScope->status == FileScope::Status::scopesBuilt)
+			fileScope->CheckWithDependencies();
+	}
+
+	// only files whose analysis went with what's on disk now, which leaves out anything open with unsaved edits.
+	std::unordered_map<uint32_t, FileSlot> saving;
+	std::vector<Entry> saved;
+	for (size_t i = 0; i < fileCount; i++)
+	{
+		auto fileScope = g_fileScopeByIndex.Read(i);
+		auto document = GetDocument(fileScope->documentHash);
+		if (!document || document->path.empty() || !document->text || fileScope->status != FileScope::Status::checked)
+			continue;
+
+		MappedFile disk;
+		if (!disk.Open(document->path) || !SameText(document->text.get(), disk.View()))
+			continue;
+
+		Entry entry = {};
+		entry.pathHash = fileScope->documentHash.value;
+		entry.contentHash = StringHash(disk.View()).value;
+		if (!Stat(document->path, &entry.mtime, &entry.size))
+			continue;
+
+		saving[fileScope->fileIndex] = { fileScope->documentHash, entry.contentHash, document->path };
+		saved.push_back(entry);
+	}
+
+	Writer contents;
+	std::vector<Entry> written;
+	for (auto& entry : saved)
+	{
+		auto fileScope = GetDocument(Hash{ .value = entry.pathHash })->fileScope;
+		std::lock_guard lock(fileScope->checkMutex);
+
+		// a restored declaration can't be worked out later, there's no tree to find its rhs in, so everything outside
+		// function bodies gets worked out now and written as evaluated.
+
+		Writer file;
+		if (!WriteFile(file, fileScope, saving))
+			continue;
+
+		entry.offset = contents.bytes.size();
+		entry.length = file.bytes.size();
+		contents.bytes.append(file.bytes);
+		written.push_back(entry);
+	}
+
+	auto contentsStart = sizeof(Header) + written.size() * sizeof(Entry);
+	for (auto& entry : written)
+	{
+		entry.offset += contentsStart;
+	}
+
+	std::string cachePath;
+	{
+		std::shared_lock lock(mutex);
+		cachePath = path;
+	}
+
+	if (cachePath.empty())
+		return 0;
+
+	// written next to it and moved over, a crash halfway through leaves the old cache.
+	auto temporaryPath = cachePath + ".tmp";
+	{
+		std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+		Header header = { magic, version, (uint32_t)written.size(), 0 };
+		out.write((const char*)&header, sizeof(header));
+		out.write((const char*)written.data(), written.size() * sizeof(Entry));
+		out.write(contents.bytes.data(), contents.bytes.size());
+		if (!out)
+			return 0;
+	}
+
+	{
+		// the old mapping has to go before the file under it can be replaced.
+		std::unique_lock lock(mutex);
+		entries.clear();
+		mapping.Close();
+
+		std::error_code error;
+		std::filesystem::rename(temporaryPath, cachePath, error);
+		if (error)
+			return 0;
+	}
+
+	Open(cachePath);
+	return (int)written.size();
+}
+
+
+// the file the entry was built with types from is still the same, either on disk or as it's loaded now.
+static bool DependencyUnchanged(const std::unordered_map<uint64_t, IndexCache::Entry>& entries, const FileSlot& slot)
+{
+	if (slot.documentHash == StringHash("builtin"))
+		return true;
+
+	auto it = entries.find(slot.documentHash.value);
+	if (it == entries.end() || it->second.contentHash != slot.contentHash)
+		return false;
+
+	auto document = GetDocument(slot.documentHash);
+	if (document && document->fileScope && document->text && document->fileScope->status != FileScope::Status::dirty)
+	{
+		// restored from this same entry, or parsed from text that has to hash the same.
+		return !document->tree || HashText(document->text.get()) == slot.contentHash;
+	}
+
+	int64_t mtime;
+	uint64_t size;
+	return Stat(slot.path, &mtime, &size) && mtime == it->second.mtime && size == it->second.size;
+}
+
+bool IndexCache::TryRestore(Hash documentHash, const std::string& filePath, GapBuffer& text)
+{
+	std::shared_lock lock(mutex);
+
+	auto it = entries.find(documentHash.value);
+	if (it == entries.end())
+		return false;
+
+	auto& entry = it->second;
+	// the text is still the mapped file here, so it's one run.
+	auto view = text.GetEntireStringView();
+	if (!view || entry.size != view->size() || entry.contentHash != StringHash(*view).value)
+	{
+		rejected++;
+		return false;
+	}
+
+	Reader reader{ mapping.Data() + entry.offset, mapping.Data() + entry.offset + entry.length };
+
+	std::vector<FileSlot> slots(reader.ReadCount(20));
+	for (auto& slot : slots)
+	{
+		slot.documentHash.value = reader.Read<uint64_t>();
+		slot.contentHash = reader.Read<uint64_t>();
+		slot.path = reader.ReadString();
+	}
+
+	if (!reader.ok || slots.empty() || slots[0].documentHash.value != documentHash.value)
+		return false;
+
+	for (size_t i = 1; i < slots.size(); i++)
+	{
+		if (!DependencyUnchanged(entries, slots[i]))
+		{
+			rejected++;
+			return false;
+		}
+	}
+
+	auto fileScope = GetOrCreateFileScope(documentHash, filePath);
+	std::lock_guard parseLock(fileScope->parseMutex);
+	std::lock_guard checkLock(fileScope->checkMutex);
+
+	auto dirtyStatus = FileScope::Status::dirty;
+	if (!fileScope->status.compare_exchange_strong(dirtyStatus, FileScope::Status::buliding))
+		return true; // someone else is building it, or already has
+
+	std::vector<uint32_t> fileIndices;
+	fileIndices.push_back(fileScope->fileIndex);
+	for (size_t i = 1; i < slots.size(); i++)
+	{
+		fileIndices.push_back(GetOrCreateFileScope(slots[i].documentHash, slots[i].path)->fileIndex);
+	}
+
+	fileScope->Clear();
+	fileScope->file.index = reader.Read<uint32_t>();
+
+	std::vector<std::string> loads(reader.ReadCount(4));
+	for (auto& load : loads)
+	{
+		load = reader.ReadString();
+	}
+
+	std::vector<std::string> imports(reader.ReadCount(4));
+	for (auto& import : imports)
+	{
+		import = reader.ReadString();
+	}
+
+	fileScope->types.resize(reader.ReadCount(12));
+	for (size_t t = 0; t < fileScope->types.size(); t++)
+	{
+		auto& type = fileScope->types.Mutable(t);
+		type.name = fileScope->StoreName(reader.ReadString());
+		type.parameters.resize(reader.ReadCount(4));
+		for (auto& parameter : type.parameters)
+		{
+			parameter = fileScope->StoreName(reader.ReadString());
+		}
+
+		type.returnTypes.resize(reader.ReadCount(14));
+		for (auto& returnType : type.returnTypes)
+		{
+			returnType = ReadHandle(reader, fileIndices);
+		}
+	}
+
+	fileScope->scopeKings.resize(reader.ReadCount(23));
+	for (size_t s = 0; s < fileScope->scopeKings.size(); s++)
+	{
+		auto& scope = fileScope->scopeKings.Mutable(s);
+		scope.declarations = Scopemap(fileScope->CurrentArena());
+		scope.tableEpoch = fileScope->publishes;
+		scope.shiftsApplied = fileScope->shiftLog.End();
+		scope.index = (uint32_t)s;
+		scope.associatedType = ReadHandle(reader, fileIndices);
+		scope.imperative = reader.Read<uint8_t>();
+		scope.exportingIn = reader.Read<uint8_t>();
+		scope.exportingOut = reader.Read<uint8_t>();
+		scope.parent.index = reader.Read<uint32_t>();
+		scope.checked = true;
+
+		auto declCount = reader.ReadCount(26);
+		for (uint32_t i = 0; i < declCount; i++)
+		{
+			auto key = IdentifierHash(reader.ReadString());
+
+			ScopeDeclaration decl;
+			decl.startByte = reader.Read<uint32_t>();
+			decl.SetLength(reader.Read<uint16_t>());
+			decl.SetRHSOffset(reader.Read<uint16_t>());
+			decl.flags = (DeclarationFlags)reader.Read<uint16_t>();
+			decl.type = ReadHandle(reader, fileIndices);
+
+			// without a tree there's no rhs to work an unevaluated one out from, it stays without a type instead of a null one.
+			scope.Add(key, decl);
+		}
+	}
+
+	auto bitwords = (fileScope->scopeKings.size() >> 6) + 1;
+	fileScope->scopePresentBitmap[0].assign(bitwords, UINT64_MAX);
+	fileScope->scopePresentBitmap[1].assign(bitwords, UINT64_MAX);
+
+	if (!reader.ok || reader.at != reader.end)
+	{
+		// corrupt, let it be parsed.
+		fileScope->Clear();
+		fileScope->status = FileScope::Status::dirty;
+		return false;
+	}
+
+	// the restored declarations read their names from this, it can't stay on the mapping the hash was checked against.
+	text.Unmap();
+	fileScope->text = std::make_shared<const GapBuffer>(text);
+	fileScope->buffer = fileScope->text.get();
+	fileScope->currentTree = nullptr;
+	fileScope->builtTree.reset();
+
+	auto generation = fileScope->journal.Reset();
+	fileScope->builtGeneration = generation;
+
+	UpdateDocument(documentHash, [&](Document& next)
+	{
+		next.path = filePath;
+		next.text = fileScope->text;
+		next.fileScope = fileScope;
+		next.generation = generation;
+	});
+
+	// same as finding the load and import nodes while building, they get loaded (or restored) in the background.
+	for (auto& load : loads)
+	{
+		fileScope->LoadFile(load);
+	}
+
+	for (auto& import : imports)
+	{
+		auto moduleNameHash = StringHash(import);
+		fileScope->imports.push_back(moduleNameHash);
+		fileScope->LoadModule(moduleNameHash, import);
+	}
+
+	fileScope->memo.Reset(fileScope->scopeKings.size());
+	fileScope->status = FileScope::Status::checked;
+	fileScope->PublishChecked();
+	restored++;
+	return true;
+}
+
+
+export_jai_lsp int OpenIndexCache(const char* path)
+{
+	g_indexCache.Open(path);
+	return (int)g_indexCache.entries.size();
+}
+
+export_jai_lsp int SaveIndexCache()
+{
+	return g_indexCache.Save();
+}
+
+export_jai_lsp void GetIndexCacheStats(uint64_t* outRestored, uint64_t* outRejected)
+{
+	*outRestored = g_indexCache.restored;
+	*outRejected = g_indexCache.rejected;
+}
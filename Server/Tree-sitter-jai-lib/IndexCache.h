@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <shared_mutex>
+#include <atomic>
+#include <stdint.h>
+
+#include "Hash.h"
+#include "MappedFile.h"
+
+class GapBuffer;
+
+
+// what analyzing the module files came up with, saved between runs so a cold start doesn't reparse every module.
+// an entry is keyed by the hash of the file's path, and remembers the mtime, size and hash of the text it was built from.
+// it's only used while the file still hashes the same, and so do the files its types came from.
+// the cache is one file, mapped at startup and read straight out of the mapping as files get loaded.
+//
+// a restored file has its scopes and types but no tree, it gets parsed for real if it's ever opened.
+// function bodies aren't kept, nothing outside the file can see into them.
+struct IndexCache
+{
+	static constexpr uint32_t magic = 0x5849414a; // "JAIX"
+	static constexpr uint32_t version = 6; // bump whenever the layout, or what the analysis finds, changes
+
+	struct Entry
+	{
+		uint64_t pathHash;
+		int64_t mtime;
+		uint64_t size;
+		uint64_t contentHash;
+		uint64_t offset; // where the entry's contents start in the cache file
+		uint64_t length;
+	};
+
+	std::shared_mutex mutex;
+	MappedFile mapping;
+	std::string path;
+	std::unordered_map<uint64_t, Entry> entries;
+
+	std::atomic<uint64_t> restored = 0;
+	std::atomic<uint64_t> rejected = 0; // had an entry, but the file or something it depends on changed
+
+	bool Open(const std::string& path);
+
+	// builds documentHash's file from its entry instead of parsing text. false if there's no entry or it's out of date.
+	bool TryRestore(Hash documentHash, const std::string& path, GapBuffer& text);
+
+	// writes every checked file that still matches what's on disk. returns how many were written.
+	int Save();
+};
+
+extern IndexCache g_indexCache;
@@ -0,0 +1,322 @@
+#include "LineIndex.h"
+#include "Newlines.h"
+
+#include <cstring>
+
+
+LineIndex::LineIndex()
+{
+	nodes.push_back(Node{});
+	uint32_t empty = 0;
+	root = BuildTree(&empty, 1);
+}
+
+void LineIndex::Build(const char* text, uint32_t length)
+{
+	// collect the newline offsets in one simd pass, then turn them into line lengths in place.
+	std::vector<uint32_t> lengths;
+	FindNewlines(text, length, lengths);
+
+	uint32_t lineStart = 0;
+	for (auto& end : lengths)
+	{
+		auto next = end + 1;
+		end = next - lineStart;
+		lineStart = next;
+	}
+
+	lengths.push_back(length - lineStart);
+
+	nodes.clear();
+	freeNodes.clear();
+	nodes.reserve(lengths.size() + 1);
+	nodes.push_back(Node{});
+	root = BuildTree(lengths.data(), lengths.size());
+}
+
+uint32_t LineIndex::NewNode(uint32_t length)
+{
+	// xorshift, a treap only needs the priorities to look random.
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+
+	auto node = Node{ .length = length, .bytes = length, .lines = 1, .priority = seed, .left = none, .right = none };
+	if (freeNodes.size() > 0)
+	{
+		auto index = freeNodes.back();
+		freeNodes.pop_back();
+		nodes[index] = node;
+		return index;
+	}
+
+	nodes.push_back(node);
+	return (uint32_t)(nodes.size() - 1);
+}
+
+void LineIndex::FreeTree(uint32_t node)
+{
+	std::vector<uint32_t> stack;
+	if (node != none)
+		stack.push_back(node);
+
+	while (stack.size() > 0)
+	{
+		auto current = stack.back();
+		stack.pop_back();
+
+		if (nodes[current].left != none)
+			stack.push_back(nodes[current].left);
+		if (nodes[current].right != none)
+			stack.push_back(nodes[current].right);
+
+		freeNodes.push_back(current);
+	}
+}
+
+void LineIndex::Update(uint32_t node)
+{
+	auto& n = nodes[node];
+	n.bytes = n.length + nodes[n.left].bytes + nodes[n.right].bytes;
+	n.lines = 1 + nodes[n.left].lines + nodes[n.right].lines;
+}
+
+// the first count lines go to left, the rest to right.
+void LineIndex::Split(uint32_t node, uint32_t count, uint32_t* left, uint32_t* right)
+{
+	if (node == none)
+	{
+		*left = none;
+		*right = none;
+		return;
+	}
+
+	auto leftLines = nodes[nodes[node].left].lines;
+	if (count <= leftLines)
+	{
+		uint32_t rest;
+		Split(nodes[node].left, count, left, &rest);
+		nodes[node].left = rest;
+		*right = node;
+	}
+	else
+	{
+		uint32_t rest;
+		Split(nodes[node].right, count - leftLines - 1, &rest, right);
+		nodes[node].right = rest;
+		*left = node;
+	}
+
+	Update(node);
+}
+
+uint32_t LineIndex::Merge(uint32_t left, uint32_t right)
+{
+	if (left == none)
+		return right;
+	if (right == none)
+		return left;
+
+	if (nodes[left].priority > nodes[right].priority)
+	{
+		auto merged = Merge(nodes[left].right, right);
+		nodes[left].right = merged;
+		Update(left);
+		return left;
+	}
+
+	auto merged = Merge(left, nodes[right].left);
+	nodes[right].left = merged;
+	Update(right);
+	return right;
+}
+
+// a cartesian tree over the priorities, made in one pass with a stack of its right spine.
+// a node is done when it comes off the spine, everything under it is already there.
+uint32_t LineIndex::BuildTree(const uint32_t* lengths, size_t count)
+{
+	std::vector<uint32_t> spine;
+	for (size_t i = 0; i < count; i++)
+	{
+		auto node = NewNode(lengths[i]);
+
+		auto below = none;
+		while (spine.size() > 0 && nodes[spine.back()].priority < nodes[node].priority)
+		{
+			below = spine.back();
+			spine.pop_back();
+			Update(below);
+		}
+
+		nodes[node].left = below;
+		if (spine.size() > 0)
+			nodes[spine.back()].right = node;
+
+		spine.push_back(node);
+	}
+
+	while (spine.size() > 1)
+	{
+		Update(spine.back());
+		spine.pop_back();
+	}
+
+	if (spine.size() == 0)
+		return none;
+
+	Update(spine[0]);
+	return spine[0];
+}
+
+uint32_t LineIndex::LineCount() const
+{
+	return nodes[root].lines;
+}
+
+uint32_t LineIndex::LineStart(uint32_t line) const
+{
+	// past the last line is the end of the text.
+	uint32_t sum = 0;
+	auto node = root;
+	while (node != none)
+	{
+		auto& n = nodes[node];
+		auto leftLines = nodes[n.left].lines;
+		if (line < leftLines)
+		{
+			node = n.left;
+			continue;
+		}
+
+		sum += nodes[n.left].bytes;
+		if (line == leftLines)
+			return sum;
+
+		sum += n.length;
+		line -= leftLines + 1;
+		node = n.right;
+	}
+
+	return sum;
+}
+
+uint32_t LineIndex::LineLength(uint32_t line) const
+{
+	auto node = root;
+	while (node != none)
+	{
+		auto& n = nodes[node];
+		auto leftLines = nodes[n.left].lines;
+		if (line < leftLines)
+		{
+			node = n.left;
+		}
+		else if (line == leftLines)
+		{
+			return n.length;
+		}
+		else
+		{
+			line -= leftLines + 1;
+			node = n.right;
+		}
+	}
+
+	return 0;
+}
+
+uint32_t LineIndex::LineOf(uint32_t offset) const
+{
+	// the line offset falls in, anything past the end is on the last line.
+	uint32_t line = 0;
+	auto node = root;
+	while (node != none)
+	{
+		auto& n = nodes[node];
+		auto leftBytes = nodes[n.left].bytes;
+		if (offset < leftBytes)
+		{
+			node = n.left;
+			continue;
+		}
+
+		offset -= leftBytes;
+		line += nodes[n.left].lines;
+		if (offset < n.length)
+			return line;
+
+		offset -= n.length;
+		line++;
+		node = n.right;
+	}
+
+	return LineCount() - 1;
+}
+
+uint32_t LineIndex::GetOffset(int line, int col) const
+{
+	return LineStart(line) + col;
+}
+
+void LineIndex::Replace(uint32_t start, uint32_t oldEnd, const char* content, uint32_t contentLength)
+{
+	auto first = LineOf(start);
+	auto last = LineOf(oldEnd);
+
+	bool newlines = contentLength > 0 && memchr(content, '\n', contentLength) != nullptr;
+
+	if (first == last && !newlines)
+	{
+		// the common case when typing, the line just gets longer or shorter, and so does everything above it.
+		auto delta = contentLength - (oldEnd - start);
+		auto line = first;
+		auto node = root;
+		while (node != none)
+		{
+			auto& n = nodes[node];
+			n.bytes += delta;
+
+			auto leftLines = nodes[n.left].lines;
+			if (line < leftLines)
+			{
+				node = n.left;
+			}
+			else if (line == leftLines)
+			{
+				n.length += delta;
+				return;
+			}
+			else
+			{
+				line -= leftLines + 1;
+				node = n.right;
+			}
+		}
+
+		return;
+	}
+
+	auto head = start - LineStart(first);
+	auto tail = LineStart(last) + LineLength(last) - oldEnd;
+
+	std::vector<uint32_t> replacement;
+	uint32_t current = head;
+	for (uint32_t i = 0; i < contentLength; i++)
+	{
+		current++;
+		if (content[i] == '\n')
+		{
+			replacement.push_back(current);
+			current = 0;
+		}
+	}
+	replacement.push_back(current + tail);
+
+	uint32_t before, spanned, after;
+	Split(root, first, &before, &spanned);
+	Split(spanned, last - first + 1, &spanned, &after);
+	FreeTree(spanned);
+
+	auto replaced = BuildTree(replacement.data(), replacement.size());
+	root = Merge(Merge(before, replaced), after);
+}
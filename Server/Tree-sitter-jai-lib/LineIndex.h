@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+
+// line start table for a text buffer.
+// keeps the length of every line (including its '\n') in a treap ordered by line, each node also holding the bytes
+// and lines under it. row/column to byte offset and byte offset to row are O(log n) descents, and an edit that
+// adds or removes lines splits out the lines it spans and merges their replacements back in, O(log n) plus the lines it touches.
+class LineIndex
+{
+	struct Node
+	{
+		uint32_t length; // this line's bytes
+		uint32_t bytes;  // bytes of the lines in this subtree
+		uint32_t lines;  // lines in this subtree
+		uint32_t priority;
+		uint32_t left;
+		uint32_t right;
+	};
+
+	// node 0 stands for no node, everything in it stays 0 so the sums don't need to check for it.
+	static constexpr uint32_t none = 0;
+
+	std::vector<Node> nodes;
+	std::vector<uint32_t> freeNodes;
+	uint32_t root = none;
+	uint32_t seed = 0x9e3779b9;
+
+	uint32_t NewNode(uint32_t length);
+	void FreeTree(uint32_t node);
+	void Update(uint32_t node);
+	void Split(uint32_t node, uint32_t count, uint32_t* left, uint32_t* right);
+	uint32_t Merge(uint32_t left, uint32_t right);
+	uint32_t BuildTree(const uint32_t* lengths, size_t count);
+
+public:
+
+	LineIndex();
+	void Build(const char* text, uint32_t length);
+
+	uint32_t LineCount() const;
+	uint32_t LineStart(uint32_t line) const;
+	uint32_t LineLength(uint32_t line) const;
+	uint32_t LineOf(uint32_t offset) const;
+	uint32_t GetOffset(int line, int col) const;
+
+	// the bytes in [start, oldEnd) were replaced by content. an edit inside one line only changes the sums on the way down to it.
+	void Replace(uint32_t start, uint32_t oldEnd, const char* content, uint32_t contentLength);
+};
@@ -0,0 +1,157 @@
+#include "MappedFile.h"
+
+#include <string_view>
+#include <utility>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+// an empty file can't be mapped, it gets this instead so it still reads as open.
+static const char s_empty[1] = {};
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+	*this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if (this != &other)
+	{
+		Close();
+		std::swap(data, other.data);
+		std::swap(size, other.size);
+		std::swap(file, other.file);
+#if defined(_WIN32)
+		std::swap(mapping, other.mapping);
+#endif
+	}
+
+	return *this;
+}
+
+#if defined(_WIN32)
+
+bool MappedFile::Open(const std::string& path)
+{
+	Close();
+
+	// sharing write and delete lets others open the file while it's open here. it doesn't let them save over it:
+	// writing to or truncating a file with a mapped view fails with ERROR_USER_MAPPED_FILE. so mappings are only
+	// held for the first parse of a file, GapBuffer::Unmap copies the text out after that.
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		file = nullptr;
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize))
+	{
+		Close();
+		return false;
+	}
+
+	size = (size_t)fileSize.QuadPart;
+	if (size == 0)
+	{
+		data = s_empty;
+		return true;
+	}
+
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping)
+	{
+		Close();
+		return false;
+	}
+
+	data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!data)
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data && data != s_empty)
+		UnmapViewOfFile(data);
+	if (mapping)
+		CloseHandle(mapping);
+	if (file)
+		CloseHandle(file);
+
+	data = nullptr;
+	size = 0;
+	mapping = nullptr;
+	file = nullptr;
+}
+
+#else
+
+bool MappedFile::Open(const std::string& path)
+{
+	Close();
+
+	file = open(path.c_str(), O_RDONLY);
+	if (file < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(file, &info) != 0)
+	{
+		Close();
+		return false;
+	}
+
+	size = (size_t)info.st_size;
+	if (size == 0)
+	{
+		data = s_empty;
+		return true;
+	}
+
+	// a private mapping still shows writes others make to the file, and reading past a truncated end is a SIGBUS.
+	// like on windows, it's only held for the first parse.
+	auto mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+	if (mapped == MAP_FAILED)
+	{
+		Close();
+		return false;
+	}
+
+	data = (const char*)mapped;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data && data != s_empty)
+		munmap((void*)data, size);
+	if (file >= 0)
+		close(file);
+
+	data = nullptr;
+	size = 0;
+	file = -1;
+}
+
+#endif
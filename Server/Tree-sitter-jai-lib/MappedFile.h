@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <stdint.h>
+
+
+// a whole file mapped read only, the bytes come straight out of the os file cache instead of being copied into a buffer.
+// the view stays valid until the file is closed, or the MappedFile goes away. keep it short lived, the file can't be saved
+// over while it's mapped, and changes made to it by others show through.
+class MappedFile
+{
+	const char* data = nullptr;
+	size_t size = 0;
+
+#if defined(_WIN32)
+	void* file = nullptr;
+	void* mapping = nullptr;
+#else
+	int file = -1;
+#endif
+
+public:
+	MappedFile() = default;
+	~MappedFile();
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Open(const std::string& path);
+	void Close();
+
+	bool IsOpen() const { return data != nullptr; }
+	const char* Data() const { return data; }
+	size_t Size() const { return size; }
+	std::string_view View() const { return std::string_view(data, size); }
+};
@@ -1,10 +1,10 @@
 #include <filesystem>
-#include <fstream>
 
 #include "TreeSitterJai.h"
 #include "FileScope.h"
 #include "Timer.h"
 #include "Concurrent.h"
+#include "IndexCache.h"
 
 ConcurrentVector<std::string> g_modulePaths;
 
@@ -12,12 +12,12 @@ std::optional<ScopeDeclaration> Module::Search(Hash hash)
 {
 	//return exportedScope.TryGet(hash);
 	// right now we're not building the module so instead search loaded files
-	return moduleFile->SearchExports(hash);
+	return GetFileScope(moduleFile->fileIndex)->SearchExports(hash);
 }
 
 int Module::SearchAndGetFile(Hash hash, FileScope** outFile, Scope** declScope)
 {
-	return moduleFile->SearchAndGetExport(hash, outFile, declScope);
+	return GetFileScope(moduleFile->fileIndex)->SearchAndGetExport(hash, outFile, declScope);
 }
 
 
@@ -27,14 +27,15 @@ export_jai_lsp long long CreateTreeFromPath(const char* document, const char* mo
 	// for modules
 	auto timer = Timer("");
 
-	std::ifstream t(document);
-	t.seekg(0, std::ios::end);
-	size_t size = t.tellg();
-	std::string buffer(size, ' ');
-	t.seekg(0);
-	t.read(&buffer[0], size);
+	auto file = std::make_shared<MappedFile>();
+	if (!file->Open(document))
+		return timer.GetMicroseconds();
 
-	CreateTree(document, buffer.c_str(), (int)buffer.length());
+	auto text = GapBuffer(file);
+	if (g_indexCache.TryRestore(StringHash(document), document, text))
+		return timer.GetMicroseconds();
+
+	CreateTreeFromText(document, std::move(text), true);
 
 	return timer.GetMicroseconds();
 }
@@ -51,9 +52,9 @@ export_jai_lsp void AddModuleDirectory(const char* moduleDirectory)
 	if (std::filesystem::exists(path))
 	{
 		FileScope::preloadHash = StringHash(path.string());
-		if (!g_filePaths.Read(FileScope::preloadHash))
+		if (!GetDocument(FileScope::preloadHash))
 		{
-			g_filePaths.Write(FileScope::preloadHash, path.string());
+			UpdateDocument(FileScope::preloadHash, [&](Document& document) { document.path = path.string(); });
 		}
 	}
 }
@@ -123,15 +124,10 @@ Module* RegisterModule(std::string moduleName, std::filesystem::path path)
 	auto pathStr = path.string();
 	auto documentHash = StringHash(pathStr);
 
-	auto scope = new FileScope();
-	scope->documentHash = documentHash;
-
-	scope->fileIndex = (uint16_t)g_fileScopeByIndex.size();
-	g_fileScopeByIndex.Append(scope);
-	g_fileScopes.Write(documentHash, scope);
-	g_filePaths.Write(documentHash, pathStr);
+	auto scope = GetOrCreateFileScope(documentHash, pathStr);
 
 	auto mod = new Module();
+	mod->name = moduleName;
 	mod->moduleFile = scope;
 	mod->moduleFileHash = documentHash;
 
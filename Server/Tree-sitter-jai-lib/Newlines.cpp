@@ -0,0 +1,200 @@
+#include "Newlines.h"
+
+#include <algorithm>
+#include <bit>
+
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define NEWLINES_SIMD 1
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define AVX2_FUNCTION
+#else
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#endif
+
+#else
+#define NEWLINES_SIMD 0
+#endif
+
+
+static void FindNewlinesFrom(const char* text, uint32_t start, uint32_t length, std::vector<uint32_t>& offsets)
+{
+	for (uint32_t i = start; i < length; i++)
+	{
+		if (text[i] == '\n')
+			offsets.push_back(i);
+	}
+}
+
+uint32_t CountNewlinesScalar(const char* text, uint32_t length)
+{
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < length; i++)
+	{
+		count += text[i] == '\n';
+	}
+
+	return count;
+}
+
+void FindNewlinesScalar(const char* text, uint32_t length, std::vector<uint32_t>& offsets)
+{
+	FindNewlinesFrom(text, 0, length, offsets);
+}
+
+#if NEWLINES_SIMD
+
+// the compare results are -1 per matching byte, so subtracting them counts matches in 16 or 32 byte lanes.
+// a lane overflows after 255 rounds, so the lanes get summed into the total with sad every 255 rounds.
+static constexpr uint32_t maxRounds = 255;
+
+static uint32_t CountNewlinesSse2(const char* text, uint32_t length)
+{
+	const __m128i newline = _mm_set1_epi8('\n');
+	uint32_t count = 0;
+	uint32_t i = 0;
+
+	while (length - i >= 16)
+	{
+		auto rounds = std::min((length - i) / 16, maxRounds);
+		auto counters = _mm_setzero_si128();
+		for (uint32_t round = 0; round < rounds; round++, i += 16)
+		{
+			auto chunk = _mm_loadu_si128((const __m128i*)(text + i));
+			counters = _mm_sub_epi8(counters, _mm_cmpeq_epi8(chunk, newline));
+		}
+
+		auto sums = _mm_sad_epu8(counters, _mm_setzero_si128());
+		count += _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+	}
+
+	return count + CountNewlinesScalar(text + i, length - i);
+}
+
+static void FindNewlinesSse2(const char* text, uint32_t length, std::vector<uint32_t>& offsets)
+{
+	const __m128i newline = _mm_set1_epi8('\n');
+	uint32_t i = 0;
+
+	for (; length - i >= 16; i += 16)
+	{
+		auto chunk = _mm_loadu_si128((const __m128i*)(text + i));
+		auto mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+		while (mask)
+		{
+			offsets.push_back(i + std::countr_zero(mask));
+			mask &= mask - 1;
+		}
+	}
+
+	FindNewlinesFrom(text, i, length, offsets);
+}
+
+AVX2_FUNCTION static uint32_t CountNewlinesAvx2(const char* text, uint32_t length)
+{
+	const __m256i newline = _mm256_set1_epi8('\n');
+	uint32_t count = 0;
+	uint32_t i = 0;
+
+	while (length - i >= 32)
+	{
+		auto rounds = std::min((length - i) / 32, maxRounds);
+		auto counters = _mm256_setzero_si256();
+		for (uint32_t round = 0; round < rounds; round++, i += 32)
+		{
+			auto chunk = _mm256_loadu_si256((const __m256i*)(text + i));
+			counters = _mm256_sub_epi8(counters, _mm256_cmpeq_epi8(chunk, newline));
+		}
+
+		auto wide = _mm256_sad_epu8(counters, _mm256_setzero_si256());
+		auto sums = _mm_add_epi64(_mm256_castsi256_si128(wide), _mm256_extracti128_si256(wide, 1));
+		count += _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+	}
+
+	return count + CountNewlinesScalar(text + i, length - i);
+}
+
+AVX2_FUNCTION static void FindNewlinesAvx2(const char* text, uint32_t length, std::vector<uint32_t>& offsets)
+{
+	const __m256i newline = _mm256_set1_epi8('\n');
+	uint32_t i = 0;
+
+	for (; length - i >= 32; i += 32)
+	{
+		auto chunk = _mm256_loadu_si256((const __m256i*)(text + i));
+		auto mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, newline));
+		while (mask)
+		{
+			offsets.push_back(i + std::countr_zero(mask));
+			mask &= mask - 1;
+		}
+	}
+
+	FindNewlinesFrom(text, i, length, offsets);
+}
+
+static bool HasAvx2()
+{
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	// the cpu has to support avx, and the os has to save the ymm registers.
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+struct NewlineKernel
+{
+	const char* name;
+	uint32_t(*count)(const char* text, uint32_t length);
+	void(*find)(const char* text, uint32_t length, std::vector<uint32_t>& offsets);
+};
+
+static NewlineKernel ChooseKernel()
+{
+#if NEWLINES_SIMD
+	if (HasAvx2())
+		return NewlineKernel{ "avx2", CountNewlinesAvx2, FindNewlinesAvx2 };
+
+	return NewlineKernel{ "sse2", CountNewlinesSse2, FindNewlinesSse2 };
+#else
+	return NewlineKernel{ "scalar", CountNewlinesScalar, FindNewlinesScalar };
+#endif
+}
+
+static const NewlineKernel& GetKernel()
+{
+	static const NewlineKernel kernel = ChooseKernel();
+	return kernel;
+}
+
+uint32_t CountNewlines(const char* text, uint32_t length)
+{
+	return GetKernel().count(text, length);
+}
+
+void FindNewlines(const char* text, uint32_t length, std::vector<uint32_t>& offsets)
+{
+	GetKernel().find(text, length, offsets);
+}
+
+const char* NewlineKernelName()
+{
+	return GetKernel().name;
+}
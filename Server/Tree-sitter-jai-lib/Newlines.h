@@ -0,0 +1,20 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+
+// newline scanning kernels. the sse2/avx2 versions compare 16/32 bytes at a time,
+// which kernel gets used is picked once at runtime based on what the cpu supports.
+
+// number of '\n' in text
+uint32_t CountNewlines(const char* text, uint32_t length);
+
+// appends the offset of every '\n' in text to offsets, in order.
+void FindNewlines(const char* text, uint32_t length, std::vector<uint32_t>& offsets);
+
+// the plain byte loops, for comparing against in benchmarks.
+uint32_t CountNewlinesScalar(const char* text, uint32_t length);
+void FindNewlinesScalar(const char* text, uint32_t length, std::vector<uint32_t>& offsets);
+
+const char* NewlineKernelName();
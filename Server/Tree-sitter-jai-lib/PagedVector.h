@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <stddef.h>
+
+
+// a vector whose elements sit in pages of pageSize, and copies of it share the pages. copying one only copies the page pointers,
+// and the first write to a page something else still holds copies that page. a snapshot of the scopes and types is a copy of these,
+// an incremental rebuild after it only copies the pages with what it rebuilt in them.
+// elements never move when it grows, a pointer to one stays good until Mutable copies its page.
+template <typename T, size_t pageSize = 64>
+class PagedVector
+{
+	struct Page
+	{
+		T items[pageSize];
+	};
+
+	std::vector<std::shared_ptr<Page>> pages;
+	size_t count = 0;
+
+	Page* OwnPage(size_t page)
+	{
+		// nobody else can get at a page the only holder of isn't handing out, so a count of one can't go up behind our back.
+		if (pages[page].use_count() > 1)
+			pages[page] = std::make_shared<Page>(*pages[page]);
+
+		return pages[page].get();
+	}
+
+public:
+	size_t size() const
+	{
+		return count;
+	}
+
+	bool empty() const
+	{
+		return count == 0;
+	}
+
+	// for reading. writes go through Mutable, or they land in a page a copy holds too.
+	T& operator[](size_t index) const
+	{
+		return pages[index / pageSize]->items[index % pageSize];
+	}
+
+	T& Mutable(size_t index)
+	{
+		return OwnPage(index / pageSize)->items[index % pageSize];
+	}
+
+	void push_back(T value)
+	{
+		if (count % pageSize == 0)
+			pages.push_back(std::make_shared<Page>());
+
+		OwnPage(count / pageSize)->items[count % pageSize] = std::move(value);
+		count++;
+	}
+
+	void resize(size_t size)
+	{
+		while (count < size)
+			push_back(T());
+
+		count = size;
+		pages.resize((count + pageSize - 1) / pageSize);
+	}
+
+	void clear()
+	{
+		pages.clear();
+		count = 0;
+	}
+};
@@ -0,0 +1,61 @@
+#include "ParserPool.h"
+#include "TreeSitterJai.h"
+
+
+std::atomic<uint64_t> ParserPool::hits = 0;
+std::atomic<uint64_t> ParserPool::misses = 0;
+
+struct IdleParsers
+{
+	std::vector<TSParser*> parsers;
+
+	~IdleParsers()
+	{
+		for (auto parser : parsers)
+		{
+			ts_parser_delete(parser);
+		}
+	}
+};
+
+static thread_local IdleParsers t_idleParsers;
+
+TSParser* ParserPool::Acquire()
+{
+	auto& idle = t_idleParsers.parsers;
+	if (idle.size() > 0)
+	{
+		auto parser = idle.back();
+		idle.pop_back();
+		hits++;
+		return parser;
+	}
+
+	misses++;
+	auto parser = ts_parser_new();
+	ts_parser_set_language(parser, g_jaiLang);
+	return parser;
+}
+
+// a parser that timed out keeps its half done parse until it's reset, the next one to get it would resume that.
+void ParserPool::Release(TSParser* parser)
+{
+	ts_parser_reset(parser);
+	ts_parser_set_timeout_micros(parser, 0);
+	ts_parser_set_cancellation_flag(parser, nullptr);
+
+	auto& idle = t_idleParsers.parsers;
+	if (idle.size() >= maxIdlePerThread)
+	{
+		ts_parser_delete(parser);
+		return;
+	}
+
+	idle.push_back(parser);
+}
+
+export_jai_lsp void GetParserPoolStats(uint64_t* outHits, uint64_t* outMisses)
+{
+	*outHits = ParserPool::hits;
+	*outMisses = ParserPool::misses;
+}
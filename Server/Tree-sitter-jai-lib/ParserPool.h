@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <stdint.h>
+#include <tree_sitter/api.h>
+
+
+// parsers are kept per thread and reused, instead of ts_parser_new/ts_parser_delete around every parse.
+// each thread keeps a small stack of idle parsers, so nested or overlapping parses on one thread still work.
+struct ParserPool
+{
+	static constexpr size_t maxIdlePerThread = 4;
+
+	static std::atomic<uint64_t> hits;
+	static std::atomic<uint64_t> misses;
+
+	static TSParser* Acquire();
+	static void Release(TSParser* parser);
+};
+
+
+// hands out a parser from the pool for the current scope.
+struct PooledParser
+{
+	TSParser* parser;
+
+	PooledParser()
+	{
+		parser = ParserPool::Acquire();
+	}
+
+	~PooledParser()
+	{
+		ParserPool::Release(parser);
+	}
+
+	PooledParser(const PooledParser&) = delete;
+	PooledParser& operator=(const PooledParser&) = delete;
+
+	operator TSParser* () const
+	{
+		return parser;
+	}
+};
@@ -1,9 +1,11 @@
 #include "Scope.h"
+#include <algorithm>
+#include <bit>
 
 
 void Scope::Clear()
 {
-	declarations.Clear();
+	declarations = declarations.Fresh();
 }
 
 std::optional<ScopeDeclaration> Scope::TryGet(const Hash hash)
@@ -24,39 +26,52 @@ void Scope::Add(const Hash hash, const ScopeDeclaration decl)
 	declarations.Add(hash, decl);
 }
 
-void Scope::AppendMembers(std::string& str, const GapBuffer* buffer, uint32_t upTo)
+// injected from another file, it's an offset into that file and that file's moves are its own.
+uint32_t Scope::DeclarationStart(const ScopeDeclaration& decl, const ShiftLog& shifts) const
+{
+	if (decl.flags & DeclarationFlags::ForeignOffset)
+		return decl.startByte;
+
+	return shifts.Apply((uint32_t)decl.startByte, shiftsApplied);
+}
+
+void Scope::AppendMembers(std::string& str, const GapBuffer* buffer, const ShiftLog& shifts, uint32_t upTo)
 {
 	auto size = declarations.Size();
-	auto data = declarations.Data();
+	auto data = declarations.Declarations();
 
 	for (int i = 0; i < size; i++)
 	{
-		auto& decl = data[i].value;
+		auto& decl = data[i];
 		//if (decl.flags & DeclarationFlags::BuiltIn)
 	//		continue;
 
-		if (imperative && (int)decl.startByte > upTo)
+		auto start = DeclarationStart(decl, shifts);
+		if (imperative && start > upTo)
 			continue;
 
 		for (int i = 0; i < decl.GetLength(); i++)
-			str.push_back(buffer->GetChar(decl.startByte + i));
+			str.push_back(buffer->GetChar(start + i));
 
 		str.push_back(',');
 	}
 }
 
-void Scope::AppendExportedMembers(std::string& str, const GapBuffer* buffer)
+void Scope::AppendExportedMembers(std::string& str, const GapBuffer* buffer, const ShiftLog& shifts)
 {
 	auto size = declarations.Size();
-	auto data = declarations.Data();
+	auto data = declarations.Declarations();
 
-	for (int i = 0; i < size; i++)
+	// a module's file scope is mostly things it doesn't export, only the ones that are get looked at.
+	for (size_t first = 0; first < size; first += 16)
 	{
-		auto& decl = data[i].value;
-		if (decl.flags & DeclarationFlags::Exported)
+		auto matches = declarations.MatchFlags(first, DeclarationFlags::Exported, DeclarationFlags::Exported);
+		for (; matches != 0; matches &= matches - 1)
 		{
+			auto& decl = data[first + std::countr_zero(matches)];
+			auto start = DeclarationStart(decl, shifts);
 			for (int i = 0; i < decl.GetLength(); i++)
-				str.push_back(buffer->GetChar(decl.startByte + i));
+				str.push_back(buffer->GetChar(start + i));
 
 			str.push_back(',');
 		}
@@ -68,23 +83,30 @@ void Scope::UpdateDeclaration(const size_t index, const ScopeDeclaration decl)
 	declarations.Update(index, decl);
 }
 
-void Scope::InjectMembersTo(Scope* otherScope, uint32_t atPosition)
+// the injected copies start where the declarations are now, otherScope hasn't missed any moves.
+void Scope::InjectMembersTo(Scope* otherScope, const ShiftLog& shifts, DeclarationFlags extraFlags)
 {
 	auto size = declarations.Size();
-	auto data = declarations.Data();
+	auto keys = declarations.Keys();
+	auto data = declarations.Declarations();
 
 	for (int i = 0; i < size; i++)
 	{
-		auto decl = data[i].value;
-		//decl.startByte = atPosition;
-		otherScope->Add(data[i].key, decl);
+		auto decl = data[i];
+		decl.startByte = DeclarationStart(decl, shifts);
+		decl.flags = decl.flags | extraFlags;
+		otherScope->Add(keys[i], decl);
 	}
 }
 
 ScopeDeclaration* Scope::GetDeclFromIndex(int index)
 {
-	auto data = declarations.Data();
-	return &data[index].value;
+	return &declarations.Declarations()[index];
+}
+
+void Scope::SetDeclarationFlags(int index, DeclarationFlags flags)
+{
+	declarations.SetFlags(index, flags);
 }
 
 int Scope::GetIndex(const Hash hash)
@@ -94,31 +116,22 @@ int Scope::GetIndex(const Hash hash)
 
 uint16_t ScopeDeclaration::GetLength() const
 {
-	uint16_t length = this->length;
-	length += (fourForEach & 0xF0);
-	return length;
+	return (uint16_t)length;
 }
 
 uint16_t ScopeDeclaration::GetRHSOffset() const
 {
-	uint16_t rhsOffset = this->rhsOffset;
-	rhsOffset += (fourForEach << 4);
-	return rhsOffset;
+	return (uint16_t)rhsOffset;
 }
 
-void ScopeDeclaration::SetLength(uint16_t length)
+// past the limit it's stuck at the limit rather than wrapping around to something short.
+// long names and right hand sides do turn up, so that isn't something to assert on.
+void ScopeDeclaration::SetLength(uint32_t length)
 {
-	assert(length < 4096);
-	this->length = (length & 0xFF);
-	fourForEach &= 0X0F;
-	length &= 0X0F;
-	fourForEach |= (length >> 4);
+	this->length = std::min(length, (uint32_t)maxLength);
 }
 
-void ScopeDeclaration::SetRHSOffset(uint16_t rhsOffset)
+void ScopeDeclaration::SetRHSOffset(uint32_t rhsOffset)
 {
-	assert(rhsOffset < 4096);
-	this->rhsOffset = (rhsOffset & 0xFF);
-	fourForEach &= 0XF0;
-	fourForEach |= (rhsOffset >> 8);
+	this->rhsOffset = std::min(rhsOffset, (uint32_t)maxLength);
 }
@@ -3,13 +3,18 @@
 #include <string>
 #include <unordered_map>
 #include <optional>
+#include <algorithm>
 #include <cassert>
 
 #include "Hash.h"
 #include "GapBuffer.h"
 
+class Arena;
 
-enum DeclarationFlags : uint16_t
+
+// as wide as the rest of ScopeDeclaration's bit fields, msvc only packs bit fields together when their types are the same size.
+// ScopeDeclaration keeps 12 bits of these, two are still free.
+enum DeclarationFlags : uint64_t
 {
 	None = 0,
 	Struct = 1 << 0,
@@ -21,15 +26,18 @@ enum DeclarationFlags : uint16_t
 	Expression = 1 << 4,
 	Constant = 1 << 5,
 	Using = 1 << 6,
-	Evaluated = 1 << 7,
+	Evaluated = 1 << 7, // the type was there when it was found, everything else is worked out into a memo next to the scopes
 
 	Iterator = 1 << 8,
+	ForeignOffset = 1 << 9, // injected by a using from another file, startByte is an offset into that file
 
 };
 
 struct ScopeHandle
 {
-	uint16_t index;
+	uint32_t index;
+
+	static constexpr uint32_t none = UINT32_MAX; // no scope, the file scope's parent
 };
 
 
@@ -43,15 +51,17 @@ enum class TypeAttribute : uint16_t
 
 struct TypeHandle
 {
-	uint16_t fileIndex;
-	uint16_t index;
+	uint32_t fileIndex;
+	uint32_t index;
 	ScopeHandle scope;
 	uint16_t attributes;
 	// consider moving members over to the handle !
 
+	static constexpr uint32_t none = UINT32_MAX;
+
 	static constexpr TypeHandle Null()
 	{
-		return TypeHandle{ .fileIndex = UINT16_MAX, .index = UINT16_MAX };
+		return TypeHandle{ .fileIndex = none, .index = none };
 	}
 
 	bool operator==(const TypeHandle& rhs) const
@@ -106,8 +116,8 @@ struct TypeHandle
 struct TypeKing
 {
 	// wwow we sure do need to handle overloads at some point!
-	std::string name;
-	std::vector<std::string> parameters;
+	std::string_view name; // zero terminated. interned if it's an identifier, otherwise in the arena of the file's build
+	std::vector<std::string_view> parameters; // in the arena of the file's build
 	std::vector<TypeHandle> returnTypes;
 };
 
@@ -118,17 +128,19 @@ inline DeclarationFlags operator|(DeclarationFlags a, DeclarationFlags b)
 }
 
 
+// everything but the type fits in 64 bits, so with the 16 byte type it's 24 bytes. a Scopemap keeps its key apart from it.
 struct ScopeDeclaration
 {
-	// we need to find somewhere to put the RHS offset from the start byte.
-	uint32_t startByte : 24; // 16 mb files seem reasonable....
+	static constexpr uint32_t maxStartByte = (1u << 28) - 1; // 256 mb, a bigger file gets no declarations
+	static constexpr uint16_t maxLength = (1u << 12) - 1;
+
+	uint64_t startByte : 28;
 
 private:
-	uint32_t fourForEach : 8;
-	uint8_t length;		
-	uint8_t rhsOffset;		
+	uint64_t length : 12;
+	uint64_t rhsOffset : 12;
 public:
-	DeclarationFlags flags; 
+	DeclarationFlags flags : 12;
 
 	union {
 		TypeHandle type;	
@@ -137,33 +149,46 @@ public:
 
 	uint16_t GetLength() const;
 	uint16_t GetRHSOffset() const;
-	void SetLength(uint16_t length);
-	void SetRHSOffset(uint16_t rhsOffset);
+	void SetLength(uint32_t length);
+	void SetRHSOffset(uint32_t rhsOffset);
 	bool HasFlags(DeclarationFlags flags)
 	{
 		return (this->flags & flags) == flags;
 	}
 };
 
+// this was 16 bytes when handles were 16 bits. the type handle alone is 16 bytes now, file, type, member scope and attributes,
+// so with the 8 bytes of bit fields a declaration is 24, half again the memory in every scope's declarations column.
 constexpr auto declSize = sizeof(ScopeDeclaration);
+static_assert(declSize == 24, "a declaration should stay 24 bytes, check the bit fields packed");
 
 
 
 
 
+// a flat open addressing table, swiss table style. slots come in groups of 16 with a byte of control each,
+// empty, deleted, or 7 bits of the key's hash, and a probe checks a whole group's control bytes at once.
+// the entries sit in columns in the order they were added, keys, declarations, and a dense copy of each declaration's flags,
+// the slots just hold an index into them, so the columns walk the declarations in source order like the stb_ds map this replaced did.
+// a probe only touches keys, and a scan for some flags checks 16 entries at once without touching a declaration that doesn't match.
+// everything lives in one allocation. like before, copying a Scopemap shares it, Copy() makes a new one.
+// a map with an arena takes its tables from it and never frees them, clearing it keeps the table to fill again.
 class Scopemap
 {
-	struct kvp
-	{
-		Hash key;
-		ScopeDeclaration value;
-	};
+	struct Table;
+	Table* table = nullptr;
+	Arena* arena = nullptr;
 
-	kvp* map = nullptr;
+	int FindSlot(Hash key) const;
+	void InsertSlot(uint64_t hash, uint32_t index);
+	void Grow();
 
-	static constexpr auto slotSize = sizeof(kvp);
+	Table* AllocateTable(uint32_t groups);
 
 public:
+	Scopemap() = default;
+	explicit Scopemap(Arena* arena) : arena(arena) {}
+
 	void Add(Hash key, ScopeDeclaration value);
 	int GetIndex(Hash key);
 	void Update(size_t index, ScopeDeclaration value);
@@ -172,8 +197,48 @@ public:
 	bool Remove(Hash key);
 	bool Contains(Hash key);
 	void Clear();
-	kvp* Data();
+	void Release(); // frees a table of its own, an arena's goes when the arena is reset
+	const Hash* Keys() const;
+	ScopeDeclaration* Declarations(); // change flags through SetFlags, or the flags column goes stale
 	ScopeDeclaration operator[](size_t) const;
+	void SetFlags(size_t index, DeclarationFlags flags);
+	uint32_t MatchFlags(size_t first, DeclarationFlags mask, DeclarationFlags value) const;
+	Scopemap Copy(Arena* arena = nullptr) const; // a map of its own with the same entries in the same order
+	Scopemap Fresh() const { return Scopemap(arena); } // an empty map out of the same arena, this one's table is left as it is
+};
+
+
+// an incremental rebuild moves everything after the function it rebuilt. the scopes it didn't touch can be a snapshot's too,
+// so instead of shifting their declarations it writes the move down here, and a declaration's start is read through
+// the moves its scope hasn't taken in yet. a scope takes them all in when its table gets copied anyway.
+struct OffsetShift
+{
+	uint32_t from; // starts at or past this move by delta
+	int32_t delta;
+};
+
+struct ShiftLog
+{
+	std::vector<OffsetShift> shifts;
+	uint32_t base = 0; // the moves every scope has taken in, dropped from the front
+
+	uint32_t End() const
+	{
+		return base + (uint32_t)shifts.size();
+	}
+
+	// start as it was once the first applied moves were made, as it is now.
+	uint32_t Apply(uint32_t start, uint32_t applied) const
+	{
+		for (auto i = std::max(applied, base); i < End(); i++)
+		{
+			auto& shift = shifts[i - base];
+			if (start >= shift.from)
+				start = (uint32_t)(start + shift.delta);
+		}
+
+		return start;
+	}
 };
 
 
@@ -184,17 +249,30 @@ struct Scope
 	TypeHandle associatedType = TypeHandle::Null();
 	bool imperative;
 	bool checked = false;
+	bool checking = false; // CheckScope is somewhere up the stack
+
+	// the #scope_export state going into and coming out of finding this scope's declarations,
+	// a rebuild of just this scope uses them to tell whether it changed anything for the scopes after it.
+	bool exportingIn = true;
+	bool exportingOut = true;
+
 	ScopeHandle parent;
 
+	uint32_t tableEpoch = 0; // the file's publish count when the table was made, it's only the file's own until the next publish
+	uint32_t shiftsApplied = 0; // how far into the file's ShiftLog the declarations' starts are
+	uint32_t index = 0; // where it is in the file's scopeKings
+
 	
-	void Clear();
+	void Clear(); // starts a new table, the old one could be a snapshot's
 	std::optional<ScopeDeclaration> TryGet(const Hash hash);
 	void Add(const Hash hash, const ScopeDeclaration decl);
-	void AppendMembers(std::string& str, const GapBuffer* buffer, uint32_t upTo = UINT_MAX);
-	void AppendExportedMembers(std::string& str, const GapBuffer* buffer);
+	uint32_t DeclarationStart(const ScopeDeclaration& decl, const ShiftLog& shifts) const;
+	void AppendMembers(std::string& str, const GapBuffer* buffer, const ShiftLog& shifts, uint32_t upTo = UINT_MAX);
+	void AppendExportedMembers(std::string& str, const GapBuffer* buffer, const ShiftLog& shifts);
 	void UpdateDeclaration(const size_t index, const ScopeDeclaration type);
-	void InjectMembersTo(Scope* otherScope, uint32_t atPosition);
+	void InjectMembersTo(Scope* otherScope, const ShiftLog& shifts, DeclarationFlags extraFlags = DeclarationFlags::None);
 	ScopeDeclaration* GetDeclFromIndex(int index);
+	void SetDeclarationFlags(int index, DeclarationFlags flags);
 	int GetIndex(const Hash hash);
 };
 
@@ -0,0 +1,175 @@
+#include "TaskScheduler.h"
+#include "TreeSitterJai.h"
+
+
+// never freed. the workers sleep on it until the process goes away, destroying it under them would hang the exit.
+TaskScheduler& g_tasks = *new TaskScheduler();
+
+static thread_local size_t t_workerIndex = SIZE_MAX;
+
+void TaskScheduler::Start()
+{
+	// the thread that waits on the loads helps run them, so leave it a core.
+	auto cores = std::thread::hardware_concurrency();
+	size_t workerCount = cores > 2 ? cores - 1 : 2;
+
+	for (size_t i = 0; i <= workerCount; i++)
+	{
+		queues.push_back(std::make_unique<Queue>());
+	}
+
+	for (size_t i = 0; i < workerCount; i++)
+	{
+		workers.emplace_back([this, i] { WorkerLoop(i); });
+	}
+}
+
+size_t TaskScheduler::WorkerCount()
+{
+	std::call_once(started, [this] { Start(); });
+	return workers.size();
+}
+
+size_t TaskScheduler::OwnQueue()
+{
+	return t_workerIndex < workers.size() ? t_workerIndex : queues.size() - 1;
+}
+
+TaskHandle TaskScheduler::Submit(std::function<void()> work)
+{
+	std::call_once(started, [this] { Start(); });
+
+	auto task = std::make_shared<Task>();
+	task->work = std::move(work);
+	unfinished++;
+
+	// counted before it's pushed, so a thief that takes it straight away can't take the count below zero.
+	available++;
+	auto& queue = *queues[OwnQueue()];
+	{
+		std::lock_guard lock(queue.mutex);
+		queue.tasks.push_back(task);
+	}
+
+	// a worker checks available under sleepMutex before it sleeps, taking it here means it can't miss this.
+	{
+		std::lock_guard lock(sleepMutex);
+	}
+	workAvailable.notify_one();
+
+	return task;
+}
+
+// newest from our own queue first, then the oldest from everyone else's.
+TaskHandle TaskScheduler::Take(size_t index, bool steal)
+{
+	{
+		auto& own = *queues[index];
+		std::lock_guard lock(own.mutex);
+		if (!own.tasks.empty())
+		{
+			auto task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+			available--;
+			return task;
+		}
+	}
+
+	if (!steal)
+		return nullptr;
+
+	for (size_t i = 1; i < queues.size(); i++)
+	{
+		auto& victim = *queues[(index + i) % queues.size()];
+		std::lock_guard lock(victim.mutex);
+		if (!victim.tasks.empty())
+		{
+			auto task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			available--;
+			stolen++;
+			return task;
+		}
+	}
+
+	return nullptr;
+}
+
+bool TaskScheduler::RunOne(bool helping)
+{
+	if (available == 0)
+		return false;
+
+	// a waiting thread only runs what's in its own queue. those were submitted by the tasks it's in the middle of,
+	// so nothing it runs can end up waiting on a task suspended further down its stack.
+	// a stolen task could, and the two threads would wait on each other forever.
+	auto task = Take(OwnQueue(), !helping);
+	if (!task)
+		return false;
+
+	task->work();
+	task->work = nullptr;
+	task->done.store(true, std::memory_order_release);
+
+	executed++;
+	if (helping)
+		helped++;
+
+	unfinished--;
+	{
+		std::lock_guard lock(sleepMutex);
+	}
+	taskDone.notify_all();
+	return true;
+}
+
+void TaskScheduler::WorkerLoop(size_t index)
+{
+	t_workerIndex = index;
+
+	while (true)
+	{
+		if (RunOne(false))
+			continue;
+
+		std::unique_lock lock(sleepMutex);
+		workAvailable.wait(lock, [this] { return available > 0; });
+	}
+}
+
+void TaskScheduler::HelpUntil(const std::function<bool()>& done)
+{
+	while (!done())
+	{
+		if (RunOne(true))
+			continue;
+
+		// everything left is running on some other thread, sleep until one of them finishes.
+		std::unique_lock lock(sleepMutex);
+		taskDone.wait(lock, done);
+	}
+}
+
+void TaskScheduler::Wait(const TaskHandle& task)
+{
+	HelpUntil([&] { return task->done.load(std::memory_order_acquire); });
+}
+
+void TaskScheduler::WaitIdle()
+{
+	HelpUntil([this] { return unfinished == 0; });
+}
+
+
+export_jai_lsp void WaitForLoads()
+{
+	g_tasks.WaitIdle();
+}
+
+export_jai_lsp void GetTaskStats(int* outWorkers, uint64_t* outExecuted, uint64_t* outStolen, uint64_t* outHelped)
+{
+	*outWorkers = (int)g_tasks.WorkerCount();
+	*outExecuted = g_tasks.executed;
+	*outStolen = g_tasks.stolen;
+	*outHelped = g_tasks.helped;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <stdint.h>
+
+
+struct Task
+{
+	std::function<void()> work;
+	std::atomic<bool> done = false;
+};
+
+using TaskHandle = std::shared_ptr<Task>;
+
+
+// a fixed set of workers for loading files, instead of an os thread for every #load and #import.
+// every worker has its own queue, it pushes and pops at the back so the loads a file spawns run close together,
+// and a worker that runs out steals from the front of someone else's.
+// waiting on a task runs the tasks in the waiting thread's own queue until it's done, so a thread waiting on
+// its dependencies loads them itself instead of blocking a worker the pool needs.
+struct TaskScheduler
+{
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<TaskHandle> tasks;
+	};
+
+	// one per worker, plus a last one shared by every thread outside the pool.
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> workers;
+	std::once_flag started;
+
+	std::mutex sleepMutex;
+	std::condition_variable workAvailable;
+	std::condition_variable taskDone;
+	std::atomic<size_t> available = 0; // sitting in a queue
+	std::atomic<size_t> unfinished = 0; // submitted and not done yet
+
+	std::atomic<uint64_t> executed = 0;
+	std::atomic<uint64_t> stolen = 0;
+	std::atomic<uint64_t> helped = 0; // run by a thread that was waiting on something
+
+	TaskHandle Submit(std::function<void()> work);
+
+	// runs tasks from this thread's queue until this one is done.
+	void Wait(const TaskHandle& task);
+
+	// runs tasks until there are none left, including the ones those tasks submit.
+	void WaitIdle();
+
+	size_t WorkerCount();
+
+private:
+	void Start();
+	void WorkerLoop(size_t index);
+	void HelpUntil(const std::function<bool()>& done);
+	bool RunOne(bool helping);
+	TaskHandle Take(size_t index, bool steal);
+	size_t OwnQueue();
+};
+
+extern TaskScheduler& g_tasks;
@@ -3,7 +3,7 @@
 
 void FileScope::HandleMemberReference(TSNode rhsNode, ScopeHandle scope)
 {
-	auto rhsHash = GetIdentifierHash(rhsNode, buffer);
+	auto rhsHash = FindIdentifierHash(rhsNode, buffer);
 
 	auto start = ts_node_start_point(rhsNode);
 	auto end = ts_node_end_point(rhsNode);
@@ -36,7 +36,7 @@ void FileScope::HandleMemberReference(TSNode rhsNode, ScopeHandle scope)
 
 static std::optional<SemanticToken> HandleVariableReferenceFromScope(TSNode node, Scope* scope, FileScope* file)
 {
-	auto hash = GetIdentifierHash(node, file->buffer);
+	auto hash = FindIdentifierHash(node, file->buffer);
 
 	auto start = ts_node_start_point(node);
 	auto end = ts_node_end_point(node);
@@ -54,7 +54,7 @@ static std::optional<SemanticToken> HandleVariableReferenceFromScope(TSNode node
 
 			// also we need to taken into account imperative scope order.
 			bool notImperative = !scope->imperative || decl->HasFlags(DeclarationFlags::Constant);
-			bool imperativeOrder = scope->imperative && decl->startByte <= ts_node_start_byte(node);
+			bool imperativeOrder = scope->imperative && file->DeclarationStart(scope, *decl) <= ts_node_start_byte(node);
 			bool expressionType = decl->HasFlags(DeclarationFlags::Expression);
 			if ((notImperative || imperativeOrder) && !expressionType)
 			{
@@ -110,12 +110,7 @@ void FileScope::DoTokens2()
 	*/
 
 	if (status == Status::scopesBuilt)
-	{
-		WaitForDependencies();
-		DoTypeCheckingAndInference(currentTree);
-
-		status = Status::checked;
-	}
+		CheckWithDependencies();
 
 	auto root = ts_tree_root_node(currentTree);
 	ScopeStack stack;
@@ -175,9 +170,6 @@ void FileScope::DoTokens2()
 	Cursor functionBodyFinder;
 	int skipPopCount = 0;
 
-	offsetToHandle.Clear();
-	offsetToHandle.Add(2, file);
-
 	while (ts_query_cursor_next_capture(queryCursor, &match, &index))
 	{
 		ScopeMarker captureType = (ScopeMarker)match.captures[index].index;
@@ -194,9 +186,6 @@ void FileScope::DoTokens2()
 
 			auto scopeHandle = GetScopeFromNodeID(node.id);
 			stack.scopes.push_back(scopeHandle);
-
-			// also build up the list of scope contexts
-			offsetToHandle.Add(ts_node_start_byte(node), scopeHandle);
 			break;
 		}
 		case ScopeMarker::func_defn:
@@ -211,8 +200,6 @@ void FileScope::DoTokens2()
 
 			auto scopeHandle = GetScopeFromNodeID(node.id);
 			stack.scopes.push_back(scopeHandle);
-
-			offsetToHandle.Add(ts_node_start_byte(node), scopeHandle);
 			break;
 		}
 		case ScopeMarker::imperativeScope:
@@ -231,8 +218,6 @@ void FileScope::DoTokens2()
 
 			auto scopeHandle = GetScopeFromNodeID(node.id);
 			stack.scopes.push_back(scopeHandle);
-
-			offsetToHandle.Add(ts_node_start_byte(node), scopeHandle);
 			break;
 		}
 		case ScopeMarker::member_rhs:
@@ -251,10 +236,10 @@ void FileScope::DoTokens2()
 			Scope* declScope;
 
 			auto declIndex = GetDeclarationForNodeFromScope(functionName, this, GetScope(stack.scopes.back()), &declFile, &declScope);
-			if (declIndex >= 0)
+			auto functionType = declIndex >= 0 ? declFile->InferDeclarationType(declScope, declIndex) : std::nullopt;
+			if (functionType)
 			{
-				auto decl = declScope->GetDeclFromIndex(declIndex);
-				auto members = declFile->GetScope(decl->type.scope);
+				auto members = declFile->GetScope(functionType->scope);
 				if (auto token = HandleVariableReferenceFromScope(identifier, members, declFile))
 					tokens.push_back(*token);
 			}
@@ -4,26 +4,25 @@
 #include <assert.h>
 #include <tree_sitter/api.h>
 #include <vector>
+#include <deque>
 #include <string_view>
 #include <filesystem>
-#include <fstream>
 #include <iostream>
 #include <shared_mutex>
 
 #include "Timer.h"
 #include "TreeSitterJai.h"
 #include "FileScope.h"
+#include "ParserPool.h"
+#include "AnalysisScheduler.h"
+#include "IndexCache.h"
 
 
 //#include "windows.h"
 
 
-ConcurrentDictionary<TSTree*> g_trees;
-ConcurrentDictionary<GapBuffer*> g_buffers;
 ConcurrentDictionary<Module*> g_modules;
-ConcurrentDictionary<FileScope*> g_fileScopes;
 ConcurrentVector<FileScope*> g_fileScopeByIndex;
-ConcurrentDictionary<std::string> g_filePaths;
 
 std::atomic<bool> g_registered;
 TSLanguage* g_jaiLang;
@@ -62,7 +61,12 @@ static void SetupBuiltInFunctions()
 
 	// create built in file scope? 
 	auto file = new FileScope();
-	g_fileScopes.Write(StringHash("builtin"), file);
+	file->documentHash = StringHash("builtin");
+
+	// it never changes, so its snapshot is the file itself. queries find the builtin types through it like any other file's.
+	auto snapshot = std::make_shared<Snapshot>();
+	snapshot->analysis = std::shared_ptr<FileScope>(file, [](FileScope*) {});
+	UpdateDocument(StringHash("builtin"), [&](Document& document) { document.fileScope = file; document.snapshot = snapshot; });
 	g_fileScopeByIndex.Append(file);
 	file->file = { 0 };
 	file->status = FileScope::Status::checked;
@@ -73,19 +77,19 @@ static void SetupBuiltInFunctions()
 		auto handle = file->AllocateType();
 
 		handle.scope = { 1 };
-		auto king = &file->types[handle.index];
-		king->name = std::string(builtins[i]);
+		auto king = file->MutableType(handle);
+		king->name = InternedName(builtins[i]);
 		ScopeDeclaration decl;
 		decl.flags = DeclarationFlags::Evaluated | DeclarationFlags::Exported;
 		decl.type = handle;
-		scope.Add(StringHash(builtins[i]), decl);
+		scope.Add(IdentifierHash(builtins[i]), decl);
 	}
 
 	auto emptyTypeHandle = file->AllocateType();
-	auto emptyKing = &file->types[emptyTypeHandle.index];
+	auto emptyKing = file->MutableType(emptyTypeHandle);
 	emptyKing->name = "";
 
-	auto boolType = scope.TryGet(StringHash("bool"))->type;
+	auto boolType = scope.TryGet(IdentifierHash("bool"))->type;
 
 	ScopeDeclaration boolDecl;
 	boolDecl.flags = DeclarationFlags::Evaluated | DeclarationFlags::Exported;
@@ -99,19 +103,19 @@ static void SetupBuiltInFunctions()
 	emptyDecl.SetLength(0);
 	emptyDecl.type = emptyTypeHandle;
 
-	scope.Add(StringHash("true"), boolDecl);
-	scope.Add(StringHash("false"), boolDecl);
-	scope.Add(StringHash("null"), emptyDecl);
+	scope.Add(IdentifierHash("true"), boolDecl);
+	scope.Add(IdentifierHash("false"), boolDecl);
+	scope.Add(IdentifierHash("null"), emptyDecl);
 
 	//file->loads.push_back(StringHash("preload.jai"));
 	file->scopeKings.push_back(scope);
-	file->scopeKings.push_back(Scope()); // empty scope for the types
+	file->scopeKings.push_back(Scope{ .index = 1 }); // empty scope for the types
 
 	FileScope::builtInScope = &file->scopeKings[0];
 	
-	FileScope::stringType = scope.TryGet(StringHash("string"))->type;
-	FileScope::intType = scope.TryGet(StringHash("int"))->type;
-	FileScope::floatType = scope.TryGet(StringHash("float"))->type;
+	FileScope::stringType = scope.TryGet(IdentifierHash("string"))->type;
+	FileScope::intType = scope.TryGet(IdentifierHash("int"))->type;
+	FileScope::floatType = scope.TryGet(IdentifierHash("float"))->type;
 	FileScope::emptyType = emptyTypeHandle;
 }
 
@@ -163,27 +167,9 @@ export_jai_lsp int Init()
 
 static inline const char* ReadGapBuffer(void* payload, uint32_t byteOffset, TSPoint position, uint32_t* bytesRead)
 {
+	// hands tree-sitter everything up to the gap, or everything after it, in one go.
 	GapBuffer* gapBuffer = (GapBuffer*)payload;
-	auto afterSize = (uint32_t)gapBuffer->after.size();
-	auto beforeSize = (uint32_t)gapBuffer->before.size();
-
-	if (byteOffset >= beforeSize + afterSize)
-	{
-		*bytesRead = 0;
-		return nullptr;
-	}
-
-	if (byteOffset < beforeSize)
-	{
-		*bytesRead = beforeSize - byteOffset;
-		return &gapBuffer->before[byteOffset];
-	}
-	else
-	{
-		int index = byteOffset - beforeSize;
-		*bytesRead = 1;
-		return &gapBuffer->after[afterSize - index - 1];
-	}
+	return gapBuffer->Read(byteOffset, bytesRead);
 }
 
 bool IsScopeNode(TSNode node)
@@ -218,7 +204,7 @@ bool GetScopeAndParentForNode(const TSNode& node, FileScope* scope, TSNode* outP
 		return false;
 	}
 
-	while (!scope->offsetToHandle.Contains(parent.context[0]))
+	while (!scope->offsetToHandle->Contains(parent.context[0]))
 	{
 		if (ts_node_is_null(parent))
 		{
@@ -229,7 +215,7 @@ bool GetScopeAndParentForNode(const TSNode& node, FileScope* scope, TSNode* outP
 	}
 
 	*outParentNode = parent;
-	*handle = scope->offsetToHandle.Get(parent.context[0]);
+	*handle = scope->offsetToHandle->Get(parent.context[0]);
 	return true;
 }
 
@@ -317,10 +303,15 @@ LSP_TokenType GetTokenTypeFromFlags(DeclarationFlags flags)
 }
 
 
+// the live tree gets edited in place and deleted by the next parse, so these print the latest snapshot's tree.
+// the snapshot holds on to it until the string is done.
 export_jai_lsp const char* GetSyntaxNice(Hash document)
 {
-	auto tree = g_trees.Read(document).value();
-	auto root = ts_tree_root_node(tree);
+	auto snapshot = g_analysis.LatestSnapshot(document);
+	if (!snapshot)
+		return nullptr;
+
+	auto root = ts_tree_root_node(snapshot->tree.get());
 
 	return ts_node_string(root);
 }
@@ -329,51 +320,172 @@ export_jai_lsp const char* GetSyntaxNice(Hash document)
 
 export_jai_lsp const char* GetSyntax(const Hash& document)
 {
-	auto tree = g_trees.Read(document).value();
-	auto root = ts_tree_root_node(tree);
-
-	return ts_node_string(root);
+	return GetSyntaxNice(document);
 }
 
 
 export_jai_lsp GapBuffer* GetGapBuffer(Hash document)
 {
-	return g_buffers.Read(document).value();
+	return GetDocument(document)->buffer;
+}
+
+// the one definition of a document hash, the c# side calls this instead of keeping its own copy of the kernel.
+export_jai_lsp uint64_t HashString(const char* text)
+{
+	return StringHash(std::string_view(text)).value;
 }
 
 
-static std::vector<TSInputEdit> s_edits;
+// a parse of the old text is of no use once the text changes, so stop it and drop any partial parse.
+// the caller holds the parse mutex after this, until it's done editing.
+static std::unique_lock<std::mutex> AbandonParse(FileScope* fileScope)
+{
+	fileScope->cancelParse = 1;
+	auto lock = std::unique_lock(fileScope->parseMutex);
+	fileScope->DropPendingParse();
+
+	return lock;
+}
 
 export_jai_lsp long long EditTree(uint64_t hashValue, const char* change, int startLine, int startCol, int endLine, int endCol, int contentLength, int rangeLength)
 {
 	auto timer = Timer("");
 	auto documentHash = Hash{ .value = hashValue };
 
-	auto buffer = g_buffers.Read(documentHash).value();
+	auto fileScope = GetDocument(documentHash)->fileScope;
+	auto lock = AbandonParse(fileScope);
+
+	// read after the lock, a parse we waited on may have published a new tree.
+	auto document = GetDocument(documentHash);
+	auto buffer = document->buffer;
 	auto edit = buffer->Edit(startLine, startCol, endLine, endCol, change, contentLength, rangeLength);
-	auto tree = g_trees.Read(documentHash).value();
+	auto tree = document->tree;
 
 	// this is maybe not thread safe, if we have two edits coming in simultaneously to the same tree.
 	ts_tree_edit(tree, &edit);
 
-	s_edits.push_back(edit);
-	// g_trees.Write(documentHash, tree); // i don't think we need this. the pointer is not getting modified.
+	// scheduled before the generation goes up, a query that sees the new generation also sees it's pending and waits for it.
+	// a worker that picks it up early waits on the lock for the edit. the scheduler never takes a parse lock while it holds its own.
+	g_analysis.Schedule(documentHash);
+	fileScope->journal.Append(edit);
+
+	lock.unlock();
+
+	return timer.GetMicroseconds();
+}
+
+static TSPoint EditEndPoint(const Edit& edit)
+{
+	auto point = TSPoint{ .row = (uint32_t)edit.startLine, .column = (uint32_t)edit.startCol };
+	for (int i = 0; i < edit.contentLength; i++)
+	{
+		if (edit.content[i] == '\n')
+		{
+			point.row++;
+			point.column = 0;
+		}
+		else
+		{
+			point.column++;
+		}
+	}
+
+	return point;
+}
+
+// merges runs of edits that continue each other, like typing a word or holding backspace,
+// so each run only moves the gap and edits the tree once. edits keep their order, since every edit
+// is relative to the text left by the ones before it.
+static void CoalesceEdits(const Edit* edits, int count, std::vector<Edit>& outEdits, std::deque<std::string>& contents)
+{
+	for (int i = 0; i < count; i++)
+	{
+		auto& next = edits[i];
+		if (outEdits.size() > 0)
+		{
+			auto& last = outEdits.back();
+			auto lastEnd = EditEndPoint(last);
+
+			bool typing = next.rangeLength == 0
+				&& next.startLine == (int)lastEnd.row && next.startCol == (int)lastEnd.column;
+
+			bool deleting = next.contentLength == 0 && last.contentLength == 0
+				&& next.endLine == last.startLine && next.endCol == last.startCol;
+
+			if (typing)
+			{
+				// the merged text lives in the string that goes with this edit
+				if (last.content != contents.back().c_str())
+				{
+					contents.back().assign(last.content, last.contentLength);
+				}
+
+				contents.back().append(next.content, next.contentLength);
+				last.content = contents.back().c_str();
+				last.contentLength += next.contentLength;
+				continue;
+			}
+
+			if (deleting)
+			{
+				last.startLine = next.startLine;
+				last.startCol = next.startCol;
+				last.rangeLength += next.rangeLength;
+				continue;
+			}
+		}
+
+		outEdits.push_back(next);
+		contents.emplace_back();
+	}
+}
+
+// applies a whole didChange worth of edits with one lookup of the buffer and the tree.
+export_jai_lsp long long ApplyEdits(uint64_t hashValue, const Edit* edits, int count)
+{
+	auto timer = Timer("");
+	auto documentHash = Hash{ .value = hashValue };
+
+	auto fileScope = GetDocument(documentHash)->fileScope;
+	auto lock = AbandonParse(fileScope);
+
+	// read after the lock, a parse we waited on may have published a new tree.
+	auto document = GetDocument(documentHash);
+	auto buffer = document->buffer;
+	auto tree = document->tree;
+
+	std::vector<Edit> coalesced;
+	std::deque<std::string> contents;
+	CoalesceEdits(edits, count, coalesced, contents);
+
+	// before the generation goes up, like EditTree.
+	g_analysis.Schedule(documentHash);
+
+	for (auto& change : coalesced)
+	{
+		auto edit = buffer->Edit(change.startLine, change.startCol, change.endLine, change.endCol, change.content, change.contentLength, change.rangeLength);
+		ts_tree_edit(tree, &edit);
+		fileScope->journal.Append(edit);
+	}
+
+	lock.unlock();
 
 	return timer.GetMicroseconds();
 }
 
 bool HandleLoad(Hash documentHash)
 {
-	auto path = g_filePaths.Read(documentHash).value();
+	auto path = GetDocument(documentHash)->path;
+
+	auto file = std::make_shared<MappedFile>();
+	if (!file->Open(path))
+		return false;
 
-	std::ifstream t(path);
-	t.seekg(0, std::ios::end);
-	size_t size = t.tellg();
-	std::string buffer(size, ' ');
-	t.seekg(0);
-	t.read(&buffer[0], size);
+	auto text = GapBuffer(file);
+	if (g_indexCache.TryRestore(documentHash, path, text))
+		return true;
 
-	CreateTree(path.c_str(), buffer.c_str(), (uint32_t)buffer.length());
+	CreateTreeFromText(path.c_str(), std::move(text), true);
 
 
 	return true;
@@ -415,6 +527,11 @@ void IncrementalUpdate(TSTree* oldTree, TSTree* newTree)
 
 
 export_jai_lsp long long CreateTree(const char* documentPath, const char* code, int length)
+{
+	return CreateTreeFromText(documentPath, GapBuffer(code, length), false);
+}
+
+long long CreateTreeFromText(const char* documentPath, GapBuffer&& text, bool lazy)
 {
 	/*
 	auto thread = ::GetCurrentThread();
@@ -431,60 +548,105 @@ export_jai_lsp long long CreateTree(const char* documentPath, const char* code,
 	auto timer = Timer("");
 
 	auto documentHash = StringHash(documentPath);
+	auto document = GetDocument(documentHash);
 
-	if (auto fileScope = g_fileScopes.Read(documentHash))
+	std::unique_lock<std::mutex> parseLock;
+	if (document && document->fileScope)
 	{
-		if (fileScope.value()->status != FileScope::Status::dirty)
+		auto fileScope = document->fileScope;
+		auto status = fileScope->status.load();
+
+		// a load of the file is being built from the text on disk. the editor's text can have unsaved changes,
+		// so wait for that build to finish and build again from the editor's text. a build holds the check lock.
+		while (!lazy && status == FileScope::Status::buliding)
+		{
+			{
+				std::lock_guard wait(fileScope->checkMutex);
+			}
+
+			status = fileScope->status.load();
+		}
+
+		// a file restored from the index cache has no tree, and one loaded from disk may not match the editor.
+		// either gets built for real once it's opened.
+		bool restored = status == FileScope::Status::checked && !document->tree;
+		bool opened = !lazy && (status == FileScope::Status::scopesBuilt || status == FileScope::Status::checked);
+		if (status != FileScope::Status::dirty && !restored && !opened)
 			return 0;
+
+		parseLock = AbandonParse(fileScope);
+		document = GetDocument(documentHash); // a parse we waited on may have published a new tree
+
+		if (restored || opened)
+			fileScope->status = FileScope::Status::dirty;
 	}
 
-	g_filePaths.Write(documentHash, documentPath);
+	// a file opened in the editor replaces a mapped buffer with one of its own here, edits only ever go to that.
 	GapBuffer* buffer;
-	if (auto bufferOpt = g_buffers.Read(documentHash))
+	if (document && document->buffer)
 	{
-		buffer = bufferOpt.value();
-		*buffer = GapBuffer(code, length);
+		buffer = document->buffer;
+		*buffer = std::move(text);
 	}
 	else
 	{
-		buffer = new GapBuffer(code, length);
-		g_buffers.Write(documentHash, buffer);
+		buffer = new GapBuffer(std::move(text));
 	}
 	
 	//timings->bufferTime = timer.GetMicroseconds();
 
+	auto parser = PooledParser();
 
-	if (auto treeOpt = g_trees.Read(documentHash))
-	{
-		ts_tree_delete(treeOpt.value());
-	}
+	TSInput input;
+	input.encoding = TSInputEncodingUTF8;
+	input.read = ReadGapBuffer;
+	input.payload = buffer;
 
-	TSParser* parser = ts_parser_new();
-	ts_parser_set_language(parser, g_jaiLang);
+	auto tree = ts_parser_parse(parser, nullptr, input);
 
-	auto view = buffer->GetEntireStringView();
-	auto tree = ts_parser_parse_string(parser, nullptr, view.data(), length);
+	// the tree is all the mapping was needed for. holding on to it would keep the editor from saving the file.
+	buffer->Unmap();
 
 	//timings->parseTime = timer.GetMicroseconds();
 
-	g_trees.Write(documentHash, tree);
-	ts_parser_delete(parser);
-
-	if (auto fileScope = g_fileScopes.Read(documentHash))
+	FileScope* fileScope;
+	uint64_t generation = 0;
+	if (document && document->fileScope)
 	{
-		fileScope.value()->Build();
+		// whatever was in the journal was for the old text.
+		fileScope = document->fileScope;
+		generation = fileScope->journal.Reset();
+		fileScope->builtGeneration = generation;
 	}
 	else
 	{
-		auto scope = new FileScope();
-		scope->documentHash = documentHash;
-
-		scope->fileIndex = (uint16_t)g_fileScopeByIndex.size();
-		g_fileScopeByIndex.Append(scope);
+		fileScope = GetOrCreateFileScope(documentHash, documentPath);
+	}
 
-		g_fileScopes.Write(documentHash, scope);
-		scope->Build();
+	UpdateDocument(documentHash, [&](Document& next)
+	{
+		next.path = documentPath;
+		next.tree = tree;
+		next.buffer = buffer;
+		next.text = std::make_shared<const GapBuffer>(*buffer);
+		next.fileScope = fileScope;
+		next.generation = generation;
+	});
+
+	// the old tree goes once the new record is out, nothing can find it after that.
+	if (document && document->tree)
+	{
+		ts_tree_delete(document->tree);
 	}
+
+	// the build gets its own copy of the tree, edits that come in while it runs only touch the live one.
+	auto buildTree = ts_tree_copy(tree);
+	auto buildText = GetDocument(documentHash)->text;
+	if (parseLock)
+		parseLock.unlock();
+
+	fileScope->lazy = lazy;
+	fileScope->Build(buildTree, std::move(buildText));
 	//timings->scopeTime = timer.GetMicroseconds();
 	// handle loads!
 	
@@ -569,17 +731,29 @@ void CheckSubtrees(TSNode oldRoot, TSNode newRoot)
 }
 
 
-// applies edits!
-export_jai_lsp long long UpdateTree(uint64_t hashValue)
+// the scheduler never runs two of these for one document at once.
+ParseStatus ReparseAndRebuild(Hash documentHash, uint64_t timeoutMicros)
 {
-	auto timer = Timer("");
-	auto documentHash = Hash{ .value = hashValue };
+	auto fileScope = GetDocument(documentHash)->fileScope;
+	auto lock = std::unique_lock(fileScope->parseMutex);
+	fileScope->cancelParse = 0;
+
+	auto document = GetDocument(documentHash);
+	auto buffer = document->buffer;
+	auto tree = document->tree;
+
+	// every edit up to here is in the buffer the parse is about to read.
+	auto generation = fileScope->journal.Generation();
 
-	auto buffer = g_buffers.Read(documentHash).value();;
-	auto tree = g_trees.Read(documentHash).value();
+	// a parser that timed out still has its state, and picks up where it left off when given the same input again.
+	// the input is only the same if no edit got in since it started, otherwise it starts over.
+	if (fileScope->pendingGeneration != generation)
+		fileScope->DropPendingParse();
 
-	TSParser* parser = ts_parser_new();
-	ts_parser_set_language(parser, g_jaiLang);
+	auto parser = fileScope->pendingParser ? fileScope->pendingParser : ParserPool::Acquire();
+	fileScope->pendingParser = nullptr;
+	ts_parser_set_timeout_micros(parser, timeoutMicros);
+	ts_parser_set_cancellation_flag(parser, (const size_t*)&fileScope->cancelParse);
 
 	TSInput input;
 	input.encoding = TSInputEncodingUTF8;
@@ -591,54 +765,138 @@ export_jai_lsp long long UpdateTree(uint64_t hashValue)
 		tree,
 		input);
 
+	if (!editedTree)
+	{
+		if (fileScope->cancelParse)
+		{
+			ParserPool::Release(parser);
+			return ParseStatus::cancelled;
+		}
 
-	g_trees.Write(documentHash, editedTree);
-	auto fileScope = g_fileScopes.Read(documentHash).value();
-	fileScope->status = FileScope::Status::dirty;
+		fileScope->pendingParser = parser;
+		fileScope->pendingGeneration = generation;
+		return ParseStatus::timedOut;
+	}
 
+	ParserPool::Release(parser);
 
-	if constexpr (fileScope->INCREMENTAL_ANALYSIS)
+	// edits wait on parseMutex, so this is what got parsed. the copy shares the buffer's chunks, the next edit copies the ones it writes to.
+	auto text = std::make_shared<const GapBuffer>(*buffer);
+	UpdateDocument(documentHash, [&](Document& next)
 	{
-		uint32_t rangeCount;
-		auto ranges = ts_tree_get_changed_ranges(tree, editedTree, &rangeCount);
-		auto root = ts_tree_root_node(editedTree);
+		next.tree = editedTree;
+		next.text = text;
+		next.generation = generation;
+	});
+	fileScope->status = FileScope::Status::dirty;
 
-		if (rangeCount > 0)
-		{
-			auto changedNode = ts_node_named_descendant_for_byte_range(root, ranges[0].start_byte, ranges[0].end_byte);
-			fileScope->RebuildScope(changedNode, s_edits.data(), (int)s_edits.size(), root);
-		}
-		else
+	// the scopes get built from a copy, edits can go to the live tree again as soon as the lock is gone.
+	// nothing else has the old tree now, so the changed ranges can still be read from it after that.
+	auto buildTree = ts_tree_copy(editedTree);
+	lock.unlock();
+
+	// edits inside a single function body only rebuild that function, anything else rebuilds the whole file.
+	// only the edits the parse started from go in, anything after that is for the next parse.
+	std::vector<TSInputEdit> edits;
+	if (fileScope->INCREMENTAL_ANALYSIS && fileScope->journal.EditsSince(fileScope->builtGeneration, generation, edits)
+		&& fileScope->RebuildScope(tree, buildTree, text, edits.data(), (int)edits.size()))
+	{
+		if (fileScope->VERIFY_INCREMENTAL_ANALYSIS)
 		{
-			auto changedNode = ts_node_named_descendant_for_byte_range(root, s_edits[0].start_byte, s_edits[0].new_end_byte);
-			fileScope->RebuildScope(changedNode, s_edits.data(), (int)s_edits.size(), root);
+			// stdout is the protocol stream, the report is for a debugger to look at.
+			std::string report;
+			auto mismatches = fileScope->CompareWithFullRebuild(report);
+			assert(mismatches == 0 && "incremental rebuild differs from a full build, see report");
+			(void)mismatches;
 		}
-
-		s_edits.clear();
-
-
-		free(ranges);
 	}
 	else
 	{
-		fileScope->Build();
+		fileScope->Build(buildTree, text);
 	}
 
-	ts_parser_delete(parser);
+	fileScope->builtGeneration = generation;
+	fileScope->journal.Trim(generation);
+
 	ts_tree_delete(tree);
 
+	return ParseStatus::done;
+}
+
+// diffs the scopes of a document against a full build of its current tree. returns the number of differences,
+// outReport describes them and stays valid until the next call on this thread.
+export_jai_lsp int VerifyIncrementalAnalysis(uint64_t hashValue, const char** outReport)
+{
+	auto fileScope = GetDocument(Hash{ .value = hashValue })->fileScope;
+	std::lock_guard<std::mutex> lock(fileScope->parseMutex);
+
+	thread_local std::string report;
+	report.clear();
+	auto mismatches = fileScope->CompareWithFullRebuild(report);
+	*outReport = report.c_str();
+
+	return mismatches;
+}
+
+// applies edits!
+export_jai_lsp long long UpdateTree(uint64_t hashValue)
+{
+	auto timer = Timer("");
+	ReparseAndRebuild(Hash{ .value = hashValue }, 0);
 	return timer.GetMicroseconds();
 }
 
+// same as UpdateTree, but gives up after timeoutMicros (0 is no limit) or when CancelParse is called.
+// a timed out parse is resumed by the next call, a cancelled one or one overtaken by an edit starts over.
+export_jai_lsp int UpdateTreeWithBudget(uint64_t hashValue, uint64_t timeoutMicros)
+{
+	return (int)ReparseAndRebuild(Hash{ .value = hashValue }, timeoutMicros);
+}
+
+export_jai_lsp void CancelParse(uint64_t hashValue)
+{
+	if (auto document = GetDocument(Hash{ .value = hashValue }); document && document->fileScope)
+	{
+		document->fileScope->cancelParse = 1;
+	}
+}
+
+// edits only get analyzed in the background once this is called, until then UpdateTree does it.
+export_jai_lsp void StartAnalysis(int workerCount, int quietWindowMillis)
+{
+	g_analysis.Start(workerCount, quietWindowMillis);
+}
+
+export_jai_lsp void StopAnalysis()
+{
+	g_analysis.Stop();
+}
+
 
 export_jai_lsp long long GetTokens(uint64_t hashValue, SemanticToken** outTokens, int* count)
 {
 	auto t = Timer("");
 	auto documentHash = Hash{ .value = hashValue };
-	auto fileScope = g_fileScopes.Read(documentHash).value();
-	fileScope->DoTokens2();
-	*outTokens = fileScope->tokens.data();
-	*count = (int)fileScope->tokens.size();
+
+	// this keeps the snapshot alive until the caller has copied the tokens.
+	thread_local SnapshotRecord snapshot;
+	snapshot = g_analysis.LatestSnapshot(documentHash);
+	if (!snapshot)
+	{
+		*outTokens = nullptr;
+		*count = 0;
+		return t.GetMicroseconds();
+	}
+
+	// worked out by the first ask for them, not by the publish. the pin keeps handles to this file inside the snapshot.
+	std::call_once(snapshot->analysis->tokensFound, []
+	{
+		SnapshotPin pin(snapshot.get());
+		snapshot->analysis->DoTokens2();
+	});
+
+	*outTokens = snapshot->analysis->tokens.data();
+	*count = (int)snapshot->analysis->tokens.size();
 
 	return t.GetMicroseconds();
 }
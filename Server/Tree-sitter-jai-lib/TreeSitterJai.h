@@ -4,6 +4,7 @@
 #include <shared_mutex>
 #include <tree_sitter/api.h>
 #include "Concurrent.h"
+#include "Document.h"
 #include "GapBuffer.h"
 #include "Scope.h"
 #include <cassert>
@@ -71,6 +72,16 @@ struct Range
 	int endRow, endCol;
 };
 
+// one content change from a didChange notification, same layout as the c# side.
+struct Edit
+{
+	const char* content;
+	int startLine, startCol;
+	int endLine, endCol;
+	int contentLength;
+	int rangeLength;
+};
+
 
 
 
@@ -83,6 +94,7 @@ struct FileScope;
 
 struct Module
 {
+	std::string name;
 	FileScope* moduleFile;
 	Hash moduleFileHash;
 
@@ -94,7 +106,6 @@ struct Module
 
 
 extern ConcurrentDictionary<Module*> g_modules;
-extern ConcurrentDictionary<FileScope*> g_fileScopes;
 
 
 
@@ -186,9 +197,6 @@ struct Constants
 };
 
 extern Constants g_constants;
-extern ConcurrentDictionary<TSTree*> g_trees;
-extern ConcurrentDictionary<GapBuffer*> g_buffers;
-extern ConcurrentDictionary<std::string> g_filePaths;
 extern ConcurrentVector<std::string> g_modulePaths;
 extern ConcurrentVector<FileScope*> g_fileScopeByIndex;
 
@@ -205,6 +213,20 @@ const TypeKing* GetType(TypeHandle handle);
 LSP_TokenType GetTokenTypeFromFlags(DeclarationFlags flags);
 
 
+enum class ParseStatus : int
+{
+	done,
+	timedOut, // call UpdateTreeWithBudget again to pick the parse back up
+	cancelled,
+};
+
+ParseStatus ReparseAndRebuild(Hash documentHash, uint64_t timeoutMicros);
+
+// CreateTree for text that's already in a buffer, a mapped file doesn't get copied on the way in.
+// lazy is for files loaded for another file's sake, only what's outside function bodies gets analyzed.
+long long CreateTreeFromText(const char* documentPath, GapBuffer&& text, bool lazy);
+
+
 struct Timings
 {
 	long long bufferTime;
@@ -213,3 +235,18 @@ struct Timings
 };
 
 export_jai_lsp long long CreateTree(const char* documentPath, const char* code, int length);
+export_jai_lsp long long ApplyEdits(uint64_t hashValue, const Edit* edits, int count);
+export_jai_lsp void GetParserPoolStats(uint64_t* outHits, uint64_t* outMisses);
+export_jai_lsp int UpdateTreeWithBudget(uint64_t hashValue, uint64_t timeoutMicros);
+export_jai_lsp void CancelParse(uint64_t hashValue);
+export_jai_lsp void StartAnalysis(int workerCount, int quietWindowMillis);
+export_jai_lsp void StopAnalysis();
+export_jai_lsp int VerifyIncrementalAnalysis(uint64_t hashValue, const char** outReport);
+export_jai_lsp void WaitForLoads();
+export_jai_lsp void GetTaskStats(int* outWorkers, uint64_t* outExecuted, uint64_t* outStolen, uint64_t* outHelped);
+export_jai_lsp int OpenIndexCache(const char* path);
+export_jai_lsp int SaveIndexCache();
+export_jai_lsp void GetIndexCacheStats(uint64_t* outRestored, uint64_t* outRejected);
+export_jai_lsp void GetIdentifierStats(uint64_t* outCount, uint64_t* outBytes, uint64_t* outLookups, uint64_t* outHits);
+export_jai_lsp uint64_t HashString(const char* text);
+export_jai_lsp void GetAllocationStats(uint64_t* outHeap, uint64_t* outArena, uint64_t* outChunks);
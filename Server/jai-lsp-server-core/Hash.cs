@@ -1,18 +1,12 @@
 ﻿namespace jai_lsp
 {
-    public static class Hash // hope this works!
+    public static class Hash
     {
+        // hashed by the native side, so a path hashes to the same document there and here.
+        // marshalled the same way as every path handed to it.
         public static ulong StringHash(string str)
         {
-            ulong hash = 0xcbf29ce484222325UL;
-
-            for (int i = 0; i < str.Length; i++)
-            {
-                hash = hash ^ str[i];
-                hash = hash * 0x00000100000001B3UL;
-            }
-
-            return hash;
+            return TreeSitter.HashString(str);
         }
     }
 }
@@ -29,6 +29,7 @@ namespace jai_lsp
             System.Diagnostics.Debugger.Launch();
 #endif
             TreeSitter.Init();
+            TreeSitter.StartAnalysis(2, 150);
 
             var server = await LanguageServer.From(options =>
                 options
@@ -74,6 +75,12 @@ namespace jai_lsp
                  
                         var path = Path.Combine(request.RootUri.GetFileSystemPath(), "modules");
                         TreeSitter.AddModuleDirectory(path);
+
+                        // the modules analyzed last time, so they don't all have to be parsed again
+                        var cacheDirectory = Path.Combine(Environment.GetFolderPath(Environment.SpecialFolder.LocalApplicationData), "jai-lsp");
+                        Directory.CreateDirectory(cacheDirectory);
+                        TreeSitter.OpenIndexCache(Path.Combine(cacheDirectory, "index-" + Hash.StringHash(path) + ".cache"));
+                        AppDomain.CurrentDomain.ProcessExit += (sender, e) => TreeSitter.SaveIndexCache();
                     })
                     .OnStarted(async (languageServer, token) =>
                     {
@@ -161,6 +168,7 @@ namespace jai_lsp
             // lmao i have no idea
 
             await server.WaitForExit;
+            TreeSitter.StopAnalysis();
         }
 
 
@@ -7,6 +7,7 @@ using OmniSharp.Extensions.LanguageServer.Protocol.Models;
 using OmniSharp.Extensions.LanguageServer.Protocol.Server;
 using OmniSharp.Extensions.LanguageServer.Protocol.Server.Capabilities;
 using System.Collections.Concurrent;
+using System.Linq;
 using System.Threading;
 using System.Threading.Tasks;
 
@@ -60,16 +61,28 @@ namespace jai_lsp
         {
             var documentPath = request.TextDocument.Uri.GetFileSystemPath();
             var hash = Hash.StringHash(documentPath);
+            var edits = new Edit[request.ContentChanges.Count()];
+            int i = 0;
             foreach (var change in request.ContentChanges)
             {
                 var range = change.Range;
                 var start = range.Start;
                 var end = range.End;
 
-                TreeSitter.EditTree(hash, change.Text, start.Line, start.Character, end.Line, end.Character, change.Text.Length, change.RangeLength);
+                edits[i++] = new Edit
+                {
+                    content = change.Text,
+                    startLine = start.Line,
+                    startCol = start.Character,
+                    endLine = end.Line,
+                    endCol = end.Character,
+                    contentLength = change.Text.Length,
+                    rangeLength = change.RangeLength,
+                };
             }
 
-            TreeSitter.UpdateTree(hash);
+            // the reparse and analysis happen on native worker threads, once the document has been quiet for a bit.
+            TreeSitter.ApplyEdits(hash, edits, edits.Length);
 
             return Unit.Task;
         }
@@ -22,6 +22,19 @@ namespace jai_lsp
         public int endCol;
     };
 
+    [StructLayout(LayoutKind.Sequential)]
+    struct Edit
+    {
+        [MarshalAs(UnmanagedType.LPStr)]
+        public string content;
+        public int startLine;
+        public int startCol;
+        public int endLine;
+        public int endCol;
+        public int contentLength;
+        public int rangeLength;
+    };
+
     [StructLayout(LayoutKind.Sequential)]
     unsafe struct Gap
     {
@@ -59,6 +72,15 @@ namespace jai_lsp
         [DllImport(dllpath)]
         extern static public long EditTree(ulong documentHash, [MarshalAs(UnmanagedType.LPStr)] string change, int startLine, int startCol, int endLine, int endCol, int contentLength, int rangeLength);
 
+        [DllImport(dllpath)]
+        extern static public void StartAnalysis(int workerCount, int quietWindowMillis);
+
+        [DllImport(dllpath)]
+        extern static public void StopAnalysis();
+
+        [DllImport(dllpath)]
+        extern static public long ApplyEdits(ulong documentHash, [In] Edit[] edits, int count);
+
         [DllImport(dllpath)]
         extern static public long GetTokens(ulong documentHash, out IntPtr tokens, out int count);
 
@@ -82,5 +104,14 @@ namespace jai_lsp
 
         [DllImport(dllpath)]
         extern static public void AddModuleDirectory([MarshalAs(UnmanagedType.LPStr)] string moduleDirectory);
+
+        [DllImport(dllpath)]
+        extern static public int OpenIndexCache([MarshalAs(UnmanagedType.LPStr)] string path);
+
+        [DllImport(dllpath)]
+        extern static public int SaveIndexCache();
+
+        [DllImport(dllpath)]
+        extern static public ulong HashString([MarshalAs(UnmanagedType.LPStr)] string text);
     }
 }